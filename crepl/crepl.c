@@ -1,214 +1,2780 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <dirent.h>
+#include <signal.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <time.h>
+#ifdef HAVE_LIBTCC
+#include <libtcc.h>
+#endif
 
-// 表达式名 计数器
-static int expr_counter = 0;
+#include "crepl.h"
 
-int exe_cmd(char *input)
+// 会话中的函数定义
+static definition defs[MAX_DEFS];
+static int def_count;
+
+// 会话中的类型声明 如 struct、typedef 拼在每个编译单元的最前面
+static char *decls;
+
+// 跳板表 第 i 个槽存 defs[i] 当前版本的地址
+// 由后端编译出来并以 SLOTS_SYMBOL 导出 编译出的代码按下标引用 不含本进程的地址
+static void **slots;
+static void *slots_module;
+
+// 编译和缓存的统计 由 :stats 输出
+static crepl_stats stats;
+
+// :set 设置的会话选项 以空白分隔 用于所有定义和表达式
+static char session_cflags[SESSION_FLAGS];
+static char session_ldflags[SESSION_FLAGS];
+
+// 当前使用的编译后端 第一次编译时选定
+static const compile_backend *backend;
+
+/**
+ * @brief 取出函数定义中的函数名
+ * @param src 函数定义
+ * @param name 结果
+ * @return 函数名在 src 中的起始位置 找不到时返回NULL
+ * @note 函数名是第一个 '(' 前面的标识符
+ */
+static const char *definition_name(const char *src, char *name)
+{
+    const char *paren = strchr(src, '(');
+    if (paren == NULL)
+        return NULL;
+    const char *end = paren;
+    while (end > src && isspace((unsigned char)end[-1]))
+        end--;
+    const char *begin = end;
+    while (begin > src && (isalnum((unsigned char)begin[-1]) || begin[-1] == '_'))
+        begin--;
+    if (begin == end || end - begin >= MAX_NAME || isdigit((unsigned char)*begin))
+        return NULL;
+    memcpy(name, begin, end - begin);
+    name[end - begin] = '\0';
+    return begin;
+}
+
+/**
+ * @brief 由函数定义生成函数指针类型
+ * @param src 函数定义
+ * @param name 函数名在 src 中的位置
+ * @param len 函数名长度
+ * @return 类型 如 "int (*)(int x)" 需要 free 没有函数体时返回NULL
+ * @note 把 '{' 之前的部分中的函数名换成 (*)
+ */
+static char *definition_type(const char *src, const char *name, size_t len)
+{
+    const char *brace = strchr(src, '{');
+    if (brace == NULL || brace < name)
+        return NULL;
+    const char *rest = name + len;
+    while (brace > rest && isspace((unsigned char)brace[-1]))
+        brace--;
+
+    char *type = malloc(brace - src + 4);
+    sprintf(type, "%.*s(*)%.*s", (int)(name - src), src, (int)(brace - rest), rest);
+    return type;
+}
+
+/**
+ * @brief 在代码前拼上已定义函数的宏
+ * @param body 代码
+ * @param self 正在编译的定义 不在表中时也可以 表达式传NULL
+ * @return 完整的源码 需要 free
+ * @note 每个函数名被定义成经跳板表的调用 (*(类型)__crepl_slots[i])
+ *       重新定义后更新槽 之前编译的代码随之调用新版本
+ *       正在编译的函数名映射到 DEF_SYMBOL 递归调用不经过跳板
+ *       类型声明在最前面 函数的类型中可以用到它们
+ *       结果只取决于声明和定义集合的名字和类型 可以作为编译缓存的键
+ *       限制：已定义的函数名不能再用作变量名或参数名
+ */
+static char *with_prelude(const char *body, const definition *self)
+{
+    size_t len = strlen(body) + 2 * MAX_NAME + 64 + (decls ? strlen(decls) : 0);
+    for (int i = 0; i < def_count; i++)
+        len += strlen(defs[i].name) + strlen(defs[i].type) + 64;
+
+    char *src = malloc(len);
+    size_t off = sprintf(src, "%sextern void *%s[];\n", decls ? decls : "", SLOTS_SYMBOL);
+    for (int i = 0; i < def_count; i++)
+    {
+        if (self != NULL && strcmp(defs[i].name, self->name) == 0)
+            continue;
+        off += sprintf(src + off, "#define %s (*(%s)%s[%d])\n",
+                       defs[i].name, defs[i].type, SLOTS_SYMBOL, i);
+    }
+    if (self != NULL)
+        off += sprintf(src + off, "#define %s %s\n", self->name, DEF_SYMBOL);
+    strcpy(src + off, body);
+    return src;
+}
+
+/**
+ * @brief 按名字查找已定义的函数
+ * @param name 函数名
+ * @return 下标 不存在时返回-1
+ * @note none
+ */
+static int find_definition(const char *name)
+{
+    for (int i = 0; i < def_count; i++)
+    {
+        if (strcmp(defs[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief 判断函数是否只接受和返回 int
+ * @param type 函数指针类型 如 "int (*)(int a, int b)"
+ * @return 参数个数 不是这种函数时返回-1
+ * @note 快速路径按参数个数转换函数指针后直接调用
+ */
+static int int_arity(const char *type)
+{
+    const char *star = strstr(type, "(*)");
+    const char *p = type;
+    while (isspace((unsigned char)*p))
+        p++;
+    if (star == NULL || strncmp(p, "int", 3) != 0)
+        return -1;
+    for (p += 3; p < star; p++)
+    {
+        if (!isspace((unsigned char)*p))
+            return -1;
+    }
+
+    p = star + 3;
+    while (isspace((unsigned char)*p))
+        p++;
+    if (*p++ != '(')
+        return -1;
+    int n = 0;
+    while (true)
+    {
+        while (isspace((unsigned char)*p))
+            p++;
+        if (n == 0 && (*p == ')' || (strncmp(p, "void", 4) == 0 && p[4] != '_' && !isalnum((unsigned char)p[4]))))
+            return strchr(p, ')')[1] == '\0' ? 0 : -1;
+        if (strncmp(p, "int", 3) != 0 || isalnum((unsigned char)p[3]) || p[3] == '_')
+            return -1;
+        p += 3;
+        while (isspace((unsigned char)*p))
+            p++;
+        while (isalnum((unsigned char)*p) || *p == '_')
+            p++; // 参数名
+        while (isspace((unsigned char)*p))
+            p++;
+        n++;
+        if (*p == ')' && p[1] == '\0')
+            return n <= FAST_MAX_ARGS ? n : -1;
+        if (*p++ != ',')
+            return -1;
+    }
+}
+
+// ======================== 算术表达式快速路径 ========================
+
+// 递归下降解析 边解析边求值 不生成任何代码
+// 只支持 int 常量、C 的整数运算符和对 int 函数的调用 其他一律交给编译器
+// live 为 false 时只解析不求值 用于 && || ?: 中不执行的分支
+
+typedef struct
+{
+    const char *p;
+    fast_status status; // 第一个非 FAST_OK 的状态
+} fast_parser;
+
+static int fast_ternary(fast_parser *ps, bool live);
+
+static void fast_skip(fast_parser *ps)
+{
+    while (isspace((unsigned char)*ps->p))
+        ps->p++;
+}
+
+static int fast_fail(fast_parser *ps, fast_status status)
+{
+    if (ps->status == FAST_OK)
+        ps->status = status;
+    return 0;
+}
+
+/**
+ * @brief 调用已定义的 int 函数
+ * @param def 定义
+ * @param args 参数
+ * @return 返回值
+ * @note 经跳板槽调用 与编译出的代码看到的是同一个版本
+ */
+static int fast_call(const definition *def, const int *args)
+{
+    switch (def->int_arity)
+    {
+    case 0:
+        return ((int (*)(void))def->addr)();
+    case 1:
+        return ((int (*)(int))def->addr)(args[0]);
+    case 2:
+        return ((int (*)(int, int))def->addr)(args[0], args[1]);
+    case 3:
+        return ((int (*)(int, int, int))def->addr)(args[0], args[1], args[2]);
+    case 4:
+        return ((int (*)(int, int, int, int))def->addr)(args[0], args[1], args[2], args[3]);
+    case 5:
+        return ((int (*)(int, int, int, int, int))def->addr)(args[0], args[1], args[2], args[3],
+                                                             args[4]);
+    default:
+        return ((int (*)(int, int, int, int, int, int))def->addr)(args[0], args[1], args[2],
+                                                                  args[3], args[4], args[5]);
+    }
+}
+
+static int fast_primary(fast_parser *ps, bool live)
+{
+    fast_skip(ps);
+    const char *p = ps->p;
+
+    if (*p == '(')
+    {
+        ps->p++;
+        int v = fast_ternary(ps, live);
+        fast_skip(ps);
+        if (*ps->p != ')')
+            return fast_fail(ps, FAST_UNSUPPORTED);
+        ps->p++;
+        return v;
+    }
+
+    if (isdigit((unsigned char)*p))
+    {
+        // 超出 int 的常量在 C 中是 long 或 unsigned 带后缀的同理 交给编译器
+        char *end;
+        errno = 0;
+        unsigned long long v = strtoull(p, &end, 0);
+        if (errno != 0 || v > INT_MAX || isalnum((unsigned char)*end) || *end == '_' || *end == '.')
+            return fast_fail(ps, FAST_UNSUPPORTED);
+        ps->p = end;
+        return (int)v;
+    }
+
+    if (*p == '\'' && p[1] != '\\' && p[1] != '\'' && (unsigned char)p[1] < 0x80 && p[2] == '\'')
+    {
+        ps->p += 3;
+        return p[1];
+    }
+
+    if (isalpha((unsigned char)*p) || *p == '_')
+    {
+        char name[MAX_NAME];
+        size_t len = 0;
+        while ((isalnum((unsigned char)p[len]) || p[len] == '_') && len < MAX_NAME - 1)
+        {
+            name[len] = p[len];
+            len++;
+        }
+        name[len] = '\0';
+        ps->p += len;
+        fast_skip(ps);
+
+        int idx = find_definition(name);
+        if (*ps->p != '(' || idx < 0 || defs[idx].int_arity < 0)
+            return fast_fail(ps, FAST_UNSUPPORTED);
+        ps->p++;
+
+        int args[FAST_MAX_ARGS];
+        int n = 0;
+        fast_skip(ps);
+        if (*ps->p != ')')
+        {
+            while (n < FAST_MAX_ARGS)
+            {
+                args[n++] = fast_ternary(ps, live);
+                fast_skip(ps);
+                if (*ps->p != ',')
+                    break;
+                ps->p++;
+            }
+        }
+        if (*ps->p != ')' || n != defs[idx].int_arity)
+            return fast_fail(ps, FAST_UNSUPPORTED);
+        ps->p++;
+        return live && ps->status == FAST_OK ? fast_call(&defs[idx], args) : 0;
+    }
+
+    return fast_fail(ps, FAST_UNSUPPORTED);
+}
+
+static int fast_unary(fast_parser *ps, bool live)
+{
+    fast_skip(ps);
+    char op = *ps->p;
+    if ((op == '-' || op == '+') && ps->p[1] == op)
+        return fast_fail(ps, FAST_UNSUPPORTED); // ++ --
+    if (op == '-' || op == '+' || op == '~' || op == '!')
+    {
+        ps->p++;
+        int v = fast_unary(ps, live);
+        switch (op)
+        {
+        case '-':
+            return (int)(0u - (unsigned)v);
+        case '~':
+            return ~v;
+        case '!':
+            return !v;
+        default:
+            return v;
+        }
+    }
+    return fast_primary(ps, live);
+}
+
+// 二元运算符 按优先级从低到高分层 同层内左结合
+static const char *const fast_ops[][4] = {
+    {"||"},
+    {"&&"},
+    {"|"},
+    {"^"},
+    {"&"},
+    {"==", "!="},
+    {"<=", ">=", "<", ">"},
+    {"<<", ">>"},
+    {"+", "-"},
+    {"*", "/", "%"},
+};
+#define FAST_LEVELS ((int)(sizeof(fast_ops) / sizeof(fast_ops[0])))
+#define FAST_OP(a, b) ((a) | (b) << 8) // 运算符的两个字符合成 switch 的标签
+
+/**
+ * @brief 识别当前位置的二元运算符
+ * @param p 当前位置
+ * @param level 结果：运算符所在的层
+ * @return 运算符 不是二元运算符时返回NULL
+ * @note 取最长匹配 避免把 || 当成 | 把 << 当成 <
+ *       后面紧跟 '=' 的是复合赋值 不算 ++ 和 -- 也不算 如 5--3 要交给编译器报错
+ */
+static const char *fast_binop(const char *p, int *level)
+{
+    if ((p[0] == '+' || p[0] == '-') && p[1] == p[0])
+        return NULL;
+    const char *best = NULL;
+    for (int l = 0; l < FAST_LEVELS; l++)
+    {
+        for (int i = 0; i < 4 && fast_ops[l][i] != NULL; i++)
+        {
+            const char *op = fast_ops[l][i];
+            size_t len = strlen(op);
+            if (strncmp(p, op, len) == 0 && (best == NULL || len > strlen(best)))
+            {
+                best = op;
+                *level = l;
+            }
+        }
+    }
+    if (best != NULL && strcmp(best, "==") != 0 && strcmp(best, "!=") != 0 &&
+        strcmp(best, "<=") != 0 && strcmp(best, ">=") != 0 && p[strlen(best)] == '=')
+        return NULL;
+    return best;
+}
+
+static int fast_binary(fast_parser *ps, int level, bool live)
+{
+    if (level == FAST_LEVELS)
+        return fast_unary(ps, live);
+
+    int lhs = fast_binary(ps, level + 1, live);
+    while (ps->status == FAST_OK)
+    {
+        fast_skip(ps);
+        int op_level;
+        const char *op = fast_binop(ps->p, &op_level);
+        if (op == NULL || op_level != level)
+            break;
+        ps->p += strlen(op);
+
+        // 短路求值 不执行的一侧只解析
+        if (strcmp(op, "&&") == 0 || strcmp(op, "||") == 0)
+        {
+            bool need = op[0] == '&' ? lhs != 0 : lhs == 0;
+            int rhs = fast_binary(ps, level + 1, live && need);
+            lhs = need ? rhs != 0 : op[0] == '|';
+            continue;
+        }
+
+        int rhs = fast_binary(ps, level + 1, live);
+        long long a = lhs, b = rhs, v;
+        switch (FAST_OP(op[0], op[1]))
+        {
+        case FAST_OP('<', '<'):
+        case FAST_OP('>', '>'):
+            // 移位越界和负数左移是未定义行为 交给编译器
+            if (b < 0 || b >= 32 || (op[0] == '<' && a < 0))
+                return fast_fail(ps, FAST_UNSUPPORTED);
+            v = op[0] == '<' ? (long long)((unsigned)a << b) : a >> b;
+            break;
+        case '/':
+        case '%':
+            if (live && (b == 0 || (a == INT_MIN && b == -1)))
+                return fast_fail(ps, FAST_ERROR);
+            v = b == 0 ? 0 : op[0] == '/' ? a / b : a % b;
+            break;
+        case '*':
+            v = a * b;
+            break;
+        case '+':
+            v = a + b;
+            break;
+        case '-':
+            v = a - b;
+            break;
+        case '|':
+            v = a | b;
+            break;
+        case '^':
+            v = a ^ b;
+            break;
+        case '&':
+            v = a & b;
+            break;
+        case FAST_OP('=', '='):
+            v = a == b;
+            break;
+        case FAST_OP('!', '='):
+            v = a != b;
+            break;
+        case '<':
+            v = a < b;
+            break;
+        case FAST_OP('<', '='):
+            v = a <= b;
+            break;
+        case '>':
+            v = a > b;
+            break;
+        default: // ">="
+            v = a >= b;
+            break;
+        }
+        lhs = (int)v; // 与 gcc 一样按补码回绕
+    }
+    return lhs;
+}
+
+static int fast_ternary(fast_parser *ps, bool live)
+{
+    int cond = fast_binary(ps, 0, live);
+    fast_skip(ps);
+    if (*ps->p != '?' || ps->status != FAST_OK)
+        return cond;
+    ps->p++;
+    int a = fast_ternary(ps, live && cond);
+    fast_skip(ps);
+    if (*ps->p != ':')
+        return fast_fail(ps, FAST_UNSUPPORTED);
+    ps->p++;
+    int b = fast_ternary(ps, live && !cond);
+    return cond ? a : b;
+}
+
+/**
+ * @brief 不经过编译器求值表达式
+ * @param expression 表达式
+ * @param result 结果
+ * @return FAST_OK 已求值 FAST_UNSUPPORTED 需要编译 FAST_ERROR 运行时错误
+ * @note 语法错误也返回 FAST_UNSUPPORTED 由编译器给出错误信息
+ */
+fast_status fast_evaluate(const char *expression, int *result)
+{
+    fast_parser ps = {.p = expression, .status = FAST_OK};
+    int v = fast_ternary(&ps, true);
+    fast_skip(&ps);
+    if (ps.status == FAST_OK && *ps.p != '\0')
+        ps.status = FAST_UNSUPPORTED;
+    if (ps.status == FAST_OK)
+        *result = v;
+    return ps.status;
+}
+
+/**
+ * @brief 预判表达式能否走快速路径
+ * @param expression 表达式
+ * @return 能解析时返回true
+ * @note 只解析不求值 函数调用按返回0处理
+ *       依赖运行时的值的情况 如移位的位数 到求值时仍可能交给编译器
+ */
+static bool fast_supported(const char *expression)
+{
+    fast_parser ps = {.p = expression, .status = FAST_OK};
+    fast_ternary(&ps, false);
+    fast_skip(&ps);
+    return ps.status == FAST_OK && *ps.p == '\0';
+}
+
+// ======================== gcc 后端 ========================
+
+// 没有 libtcc 时的后备方案 源码经管道从标准输入送入 gcc
+// 每个定义编译成单独的共享库 新增一个函数只需编译它自己
+// 共享库写进 memfd 经 /proc/PID/fd/N 交给 gcc 和 dlopen 不落到文件系统上
+// 编译结果按内容缓存 同一段源码和编译选项在本会话和之后的会话中都不再编译
+// gcc 进程提前启动 在读标准输入处等待 启动和解析选项的开销不计入每行的延迟
+// 常用头文件预编译 每个编译单元只需载入预编译头
+
+// 编译和预编译头共用的选项
+static const char *const gcc_flags[] = {"-pipe", "-fPIC", "-w"};
+
+// 每个编译单元都包含的头文件 定义和表达式可以直接使用其中的函数
+static const char prelude_headers[] =
+    "#include <limits.h>\n#include <math.h>\n#include <stdbool.h>\n#include <stddef.h>\n"
+    "#include <stdint.h>\n#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n"
+    // 表达式的包装函数用它区分指针和结构体 tcc 没有这个内建函数 指针都按对象输出
+    "#ifdef __TINYC__\n#define __crepl_is_pointer(v) 0\n"
+    "#else\n#define __crepl_is_pointer(v) (__builtin_classify_type(v) == 5)\n#endif\n";
+
+// 编译命令 由 gcc_command 生成 源码从标准输入读入 输出路径和会话的选项追加在最后
+// -nostdlib 不链接 crt 和 libc 未定义的符号在 dlopen 时从 crepl 进程中解析 省掉大半链接时间
+// -Bsymbolic 让库内的引用绑定到自己 各模块导出的同名符号互不干扰
+static const char *gcc_argv[GCC_MAX_ARGS];
+static int gcc_argc;
+
+// 预编译头 header 与 header.gch 放在缓存目录中 没有缓存目录时放在会话的临时目录中
+static char pch_header[PATH_MAX + 64];
+static char pch_tmpdir[PATH_MAX]; // 会话的临时目录 退出时删除
+
+// 提前启动的 gcc 进程
+typedef struct
+{
+    pid_t pid;
+    int in;  // 源码管道的写端
+    int out; // 接收共享库的 memfd
+} gcc_worker;
+
+static gcc_worker pool[POOL_SIZE];
+static int pool_count;
+static pid_t pool_owner; // 启动这些进程的 crepl 进程 fork 出的子进程不能使用它们
+
+// 内容寻址的编译缓存 每项是存有共享库的 memfd 会话内不关闭
+typedef struct
+{
+    unsigned __int128 key;
+    int fd;
+} cache_entry;
+
+static cache_entry cache[CACHE_ENTRIES];
+static int cache_count;
+static char cache_dir[PATH_MAX]; // 跨会话的缓存目录 为空表示不可用
+
+/**
+ * @brief 启动 gcc 从管道读入源码
+ * @param argv 命令
+ * @param in 结果：管道的写端
+ * @return gcc 的进程号 失败时返回-1
+ * @note 写端带 O_CLOEXEC 否则之后启动的 gcc 也持有它 关闭后读端等不到 EOF
+ */
+static pid_t spawn_gcc(char **argv, int *in)
+{
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1)
+    {
+        perror("pipe");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        // 子进程 自成一个进程组 结束时连同 cc1、as 一起杀掉
+        // 汇编器的中间目标文件放在内存文件系统中
+        setpgid(0, 0);
+        dup2(fds[0], STDIN_FILENO);
+        if (access("/dev/shm", W_OK) == 0)
+            setenv("TMPDIR", "/dev/shm", 1);
+        execvp("gcc", argv);
+        perror("gcc");
+        _exit(127);
+    }
+    // 父子进程都设置进程组 避免子进程还没来得及设置时就要杀掉它
+    setpgid(pid, pid);
+    close(fds[0]);
+    *in = fds[1];
+    return pid;
+}
+
+/**
+ * @brief 把源码写给 gcc
+ * @param in 管道的写端 写完后关闭
+ * @param src 源码
+ * @return void
+ * @note 关闭写端后 gcc 读到 EOF 开始编译
+ */
+static void feed_gcc(int in, const char *src)
+{
+    size_t len = strlen(src);
+    for (size_t done = 0; done < len;)
+    {
+        ssize_t n = write(in, src + done, len - done);
+        if (n <= 0)
+            break; // gcc 提前退出 由退出码报告错误
+        done += n;
+    }
+    close(in);
+}
+
+static bool wait_gcc(pid_t pid)
+{
+    int status;
+    if (waitpid(pid, &status, 0) == -1)
+        return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+ * @brief 把以空白分隔的选项追加到命令中
+ * @param argv 命令
+ * @param argc 已有的参数数
+ * @param max 参数数上限 不含结尾的NULL
+ * @param flags 选项 会被改写 各参数指向其中
+ * @return 新的参数数
+ * @note none
+ */
+static int append_flags(char **argv, int argc, int max, char *flags)
+{
+    char *save;
+    for (char *t = strtok_r(flags, " \t", &save); t && argc < max; t = strtok_r(NULL, " \t", &save))
+        argv[argc++] = t;
+    argv[argc] = NULL;
+    return argc;
+}
+
+/**
+ * @brief 启动一个等待源码的 gcc 进程
+ * @param w 结果
+ * @param flags 追加在会话选项之后的选项 以空白分隔 NULL表示没有
+ * @return 成功返回true
+ * @note 输出路径用本进程的 /proc/PID/fd/N gcc 和它启动的 ld 都能打开 不依赖 fd 的继承
+ *       gcc 的选项可以出现在输出路径之后 后出现的 -O 等选项覆盖前面的
+ */
+static bool worker_spawn(gcc_worker *w, const char *flags)
+{
+    w->out = memfd_create("crepl", MFD_CLOEXEC);
+    if (w->out == -1)
+    {
+        perror("memfd_create");
+        return false;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/fd/%d", (int)getpid(), w->out);
+
+    size_t len = strlen(session_cflags) + strlen(session_ldflags) + (flags ? strlen(flags) : 0) + 3;
+    char *extra = malloc(len);
+    snprintf(extra, len, "%s %s %s", session_cflags, session_ldflags, flags ? flags : "");
+    char *argv[2 * GCC_MAX_ARGS + 2];
+    memcpy(argv, gcc_argv, gcc_argc * sizeof(char *));
+    argv[gcc_argc] = path;
+    append_flags(argv, gcc_argc + 1, 2 * GCC_MAX_ARGS, extra);
+    w->pid = spawn_gcc(argv, &w->in);
+    free(extra);
+    if (w->pid == -1)
+    {
+        close(w->out);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 结束所有提前启动的 gcc
+ * @param void
+ * @return void
+ * @note 退出时和编译选项改变时调用 由 fork 继承来的进程不属于自己 只关闭 fd
+ */
+static void pool_drain(void)
+{
+    for (int i = 0; i < pool_count; i++)
+    {
+        // 先关闭管道 即使没杀掉 gcc 也会读到 EOF 退出
+        close(pool[i].in);
+        close(pool[i].out);
+        if (pool_owner == getpid())
+        {
+            kill(-pool[i].pid, SIGKILL);
+            waitpid(pool[i].pid, NULL, 0);
+        }
+    }
+    pool_count = 0;
+}
+
+/**
+ * @brief 把提前启动的 gcc 补足到 POOL_SIZE 个
+ * @param void
+ * @return void
+ * @note none
+ */
+static void pool_fill(void)
+{
+    if (pool_owner != getpid())
+    {
+        pool_drain();
+        pool_owner = getpid();
+    }
+    while (pool_count < POOL_SIZE && worker_spawn(&pool[pool_count], NULL))
+        pool_count++;
+}
+
+/**
+ * @brief 用提前启动的 gcc 把源码编译成共享库
+ * @param src 源码
+ * @param flags 追加的编译选项 NULL表示没有
+ * @return 存有共享库的 memfd 失败时返回-1
+ * @note 编译完立即补一个新进程 它在用户输入下一行时完成启动
+ *       带追加选项的编译不多见 临时启动一个 gcc
+ */
+static int run_gcc(const char *src, const char *flags)
+{
+    gcc_worker w;
+    if (flags != NULL)
+    {
+        if (!worker_spawn(&w, flags))
+            return -1;
+    }
+    else
+    {
+        pool_fill();
+        if (pool_count == 0)
+            return -1;
+        w = pool[--pool_count];
+    }
+    feed_gcc(w.in, src);
+    bool ok = wait_gcc(w.pid);
+    pool_fill();
+    if (!ok)
+    {
+        close(w.out);
+        return -1;
+    }
+    return w.out;
+}
+
+/**
+ * @brief 累加 FNV-1a 哈希
+ * @param h 当前的哈希
+ * @param s 字符串 连同结尾的 \0 一起计入 作为相邻字符串的分隔
+ * @return 新的哈希
+ * @note none
+ */
+static unsigned __int128 fnv_update(unsigned __int128 h, const char *s)
+{
+    const unsigned __int128 prime = ((unsigned __int128)1 << 88) + 0x13b;
+    do
+        h = (h ^ (unsigned char)*s) * prime;
+    while (*s++);
+    return h;
+}
+
+#define FNV_BASIS ((unsigned __int128)0x6c62272e07bb0142ull << 64 | 0x62b821756295c58dull)
+
+/**
+ * @brief 确定跨会话的缓存目录
+ * @param void
+ * @return void
+ * @note 依次取 $CREPL_CACHE、$XDG_CACHE_HOME/crepl、$HOME/.cache/crepl
+ *       目录不可用时只在会话内缓存
+ */
+static void cache_open(void)
+{
+    const char *env;
+    if ((env = getenv("CREPL_CACHE")) != NULL)
+        snprintf(cache_dir, sizeof(cache_dir), "%s", env);
+    else if ((env = getenv("XDG_CACHE_HOME")) != NULL)
+        snprintf(cache_dir, sizeof(cache_dir), "%s/crepl", env);
+    else if ((env = getenv("HOME")) != NULL)
+    {
+        snprintf(cache_dir, sizeof(cache_dir), "%s/.cache", env);
+        mkdir(cache_dir, 0755);
+        snprintf(cache_dir, sizeof(cache_dir), "%s/.cache/crepl", env);
+    }
+    if (cache_dir[0] != '\0' && mkdir(cache_dir, 0755) == -1 && errno != EEXIST)
+        cache_dir[0] = '\0';
+    if (cache_dir[0] != '\0')
+        cache_prune(cache_dir, (long long)CACHE_MAX_MB << 20);
+}
+
+// 缓存目录中的一个文件
+typedef struct
+{
+    char name[NAME_MAX + 1];
+    long long size;
+    struct timespec mtime;
+} cache_file;
+
+static int cache_file_cmp(const void *x, const void *y)
+{
+    const struct timespec *a = &((const cache_file *)x)->mtime, *b = &((const cache_file *)y)->mtime;
+    return a->tv_sec != b->tv_sec ? (a->tv_sec > b->tv_sec) - (a->tv_sec < b->tv_sec)
+                                  : (a->tv_nsec > b->tv_nsec) - (a->tv_nsec < b->tv_nsec);
+}
+
+/**
+ * @brief 限制缓存目录的大小
+ * @param dir 缓存目录
+ * @param max_bytes 上限
+ * @return void
+ * @note 超出上限时按修改时间从旧到新删除 命中时会更新修改时间 所以删掉的是最久没用的
+ *       只处理缓存写出的 .so 和中断后留下的临时文件 目录里的其他文件不动
+ */
+void cache_prune(const char *dir, long long max_bytes)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return;
+    cache_file *files = NULL;
+    int n = 0, cap = 0;
+    long long total = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL)
+    {
+        struct stat st;
+        if (strstr(e->d_name, ".so") == NULL || fstatat(dirfd(d), e->d_name, &st, 0) == -1 ||
+            !S_ISREG(st.st_mode))
+            continue;
+        if (n == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            cache_file *grown = realloc(files, cap * sizeof(*files));
+            if (grown == NULL)
+                break;
+            files = grown;
+        }
+        snprintf(files[n].name, sizeof(files[n].name), "%s", e->d_name);
+        files[n].size = st.st_size;
+        files[n].mtime = st.st_mtim;
+        total += st.st_size;
+        n++;
+    }
+
+    if (total > max_bytes)
+    {
+        qsort(files, n, sizeof(*files), cache_file_cmp);
+        for (int i = 0; i < n && total > max_bytes; i++)
+        {
+            if (unlinkat(dirfd(d), files[i].name, 0) == 0)
+                total -= files[i].size;
+        }
+    }
+    closedir(d);
+    free(files);
+}
+
+/**
+ * @brief 写文件 先写临时文件再改名
+ * @param path 路径
+ * @param data 内容
+ * @return 成功返回true
+ * @note 并发的会话不会读到写了一半的文件
+ */
+static bool write_file(const char *path, const char *data)
+{
+    char tmp[PATH_MAX + 96];
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL)
+        return false;
+    bool ok = fputs(data, fp) >= 0;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp, path) == -1)
+    {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+static void pch_cleanup(void)
+{
+    if (pool_owner != getpid())
+        return;
+    char path[PATH_MAX + 96];
+    snprintf(path, sizeof(path), "%s.gch", pch_header);
+    unlink(path);
+    unlink(pch_header);
+    rmdir(pch_tmpdir);
+}
+
+/**
+ * @brief 生成预编译头
+ * @param void
+ * @return 头文件可用返回true 否则编译单元不含 prelude_headers
+ * @note 文件名含头文件内容和选项的哈希 缓存目录中已有时直接使用
+ *       会话的编译选项也用于预编译 -O 等选项不一致时 gcc 不使用预编译头
+ *       预编译头与编译时的选项不符时 gcc 会退回解析头文件本身 结果仍然正确
+ */
+static bool pch_prepare(void)
+{
+    const char *dir = cache_dir;
+    if (dir[0] == '\0')
+    {
+        if (pch_tmpdir[0] == '\0')
+        {
+            const char *tmp = access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp";
+            snprintf(pch_tmpdir, sizeof(pch_tmpdir), "%s/crepl-XXXXXX", tmp);
+            if (mkdtemp(pch_tmpdir) == NULL)
+            {
+                pch_tmpdir[0] = '\0';
+                return false;
+            }
+            atexit(pch_cleanup);
+        }
+        else
+        {
+            // 选项改变 旧的预编译头不再使用
+            pch_cleanup();
+            mkdir(pch_tmpdir, 0700);
+        }
+        dir = pch_tmpdir;
+    }
+
+    unsigned __int128 h = fnv_update(FNV_BASIS, prelude_headers);
+    for (size_t i = 0; i < sizeof(gcc_flags) / sizeof(gcc_flags[0]); i++)
+        h = fnv_update(h, gcc_flags[i]);
+    h = fnv_update(h, session_cflags);
+    snprintf(pch_header, sizeof(pch_header), "%s/prelude-%016llx.h", dir,
+             (unsigned long long)(h >> 64 ^ h));
+
+    char gch[PATH_MAX + 96], tmp[PATH_MAX + 128];
+    snprintf(gch, sizeof(gch), "%s.gch", pch_header);
+    if (access(pch_header, R_OK) == 0 && access(gch, R_OK) == 0)
+        return true;
+    if (!write_file(pch_header, prelude_headers))
+        return false;
+
+    // 预编译头写到临时文件后改名 gcc 不接受从标准输入预编译头文件
+    snprintf(tmp, sizeof(tmp), "%s.%d", gch, (int)getpid());
+    char *argv[2 * GCC_MAX_ARGS + 2];
+    int argc = 0;
+    argv[argc++] = "gcc";
+    for (size_t i = 0; i < sizeof(gcc_flags) / sizeof(gcc_flags[0]); i++)
+        argv[argc++] = (char *)gcc_flags[i];
+    char *cflags = strdup(session_cflags);
+    argc = append_flags(argv, argc, 2 * GCC_MAX_ARGS - 5, cflags);
+    char *tail[] = {"-x", "c-header", pch_header, "-o", tmp, NULL};
+    memcpy(argv + argc, tail, sizeof(tail));
+
+    int in;
+    pid_t pid = spawn_gcc(argv, &in);
+    free(cflags);
+    if (pid != -1)
+        close(in);
+    if (pid != -1 && wait_gcc(pid) && rename(tmp, gch) == 0)
+        return true;
+    unlink(tmp);
+    return true; // 只有头文件时仍然可用 只是每次都要解析
+}
+
+/**
+ * @brief 计算编译缓存的键
+ * @param src 完整的源码 已含定义集合对应的前缀
+ * @param flags 追加的编译选项 NULL表示没有
+ * @return 128 位 FNV-1a 哈希
+ * @note 编译命令和会话的选项也计入 改变编译选项或预编译的头文件不会命中旧的结果
+ */
+static unsigned __int128 cache_key(const char *src, const char *flags)
+{
+    unsigned __int128 h = FNV_BASIS;
+    for (int i = 0; i < gcc_argc; i++)
+        h = fnv_update(h, gcc_argv[i]);
+    h = fnv_update(h, session_cflags);
+    h = fnv_update(h, session_ldflags);
+    if (flags != NULL)
+        h = fnv_update(h, flags);
+    return fnv_update(h, src);
+}
+
+static void cache_path(char *path, size_t size, unsigned __int128 key)
+{
+    snprintf(path, size, "%s/%016llx%016llx.so", cache_dir,
+             (unsigned long long)(key >> 64), (unsigned long long)key);
+}
+
+/**
+ * @brief 在缓存中查找编译结果
+ * @param key 缓存键
+ * @return 存有共享库的 memfd 未命中时返回-1
+ * @note 先查会话内的表 再查缓存目录 磁盘上的命中读进 memfd 后加入会话内的表
+ */
+static int cache_lookup(unsigned __int128 key)
+{
+    for (int i = 0; i < cache_count; i++)
+    {
+        if (cache[i].key == key)
+        {
+            stats.mem_hits++;
+            return cache[i].fd;
+        }
+    }
+    if (cache_dir[0] == '\0' || cache_count == CACHE_ENTRIES)
+        return -1;
+
+    char path[PATH_MAX + 64];
+    cache_path(path, sizeof(path), key);
+    int file = open(path, O_RDONLY | O_CLOEXEC);
+    if (file == -1)
+        return -1;
+    struct stat st;
+    int fd = memfd_create("crepl-cache", MFD_CLOEXEC);
+    bool ok = fd != -1 && fstat(file, &st) == 0 &&
+              sendfile(fd, file, NULL, st.st_size) == st.st_size;
+    if (ok)
+        futimens(file, NULL); // 留给 cache_prune 判断新旧
+    close(file);
+    if (!ok)
+    {
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    stats.disk_hits++;
+    cache[cache_count++] = (cache_entry){.key = key, .fd = fd};
+    return fd;
+}
+
+/**
+ * @brief 把新的编译结果加入缓存
+ * @param key 缓存键
+ * @param fd 存有共享库的 memfd
+ * @return 加入会话内的表返回true 此后 fd 归缓存所有
+ * @note 写磁盘时先写临时文件再改名 并发的会话不会读到写了一半的库
+ */
+static bool cache_insert(unsigned __int128 key, int fd)
+{
+    if (cache_dir[0] != '\0')
+    {
+        char path[PATH_MAX + 64], tmp[PATH_MAX + 96];
+        cache_path(path, sizeof(path), key);
+        snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+        int file = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        struct stat st;
+        off_t off = 0;
+        bool ok = file != -1 && fstat(fd, &st) == 0 &&
+                  sendfile(file, fd, &off, st.st_size) == st.st_size;
+        if (file != -1)
+            close(file);
+        if (!ok || rename(tmp, path) == -1)
+            unlink(tmp);
+    }
+
+    if (cache_count == CACHE_ENTRIES)
+        return false;
+    cache[cache_count++] = (cache_entry){.key = key, .fd = fd};
+    return true;
+}
+
+// gcc 后端的模块
+// dlopen 按路径字符串识别已加载的库 memfd 要和共享库一起保留 否则 fd 号被复用会拿到旧库
+// 缓存中的 memfd 由缓存持有 其余的由模块持有
+typedef struct
+{
+    void *handle;
+    int fd; // 模块自己持有的 memfd 没有时为-1
+} gcc_module;
+
+/**
+ * @brief 生成编译命令
+ * @param void
+ * @return void
+ * @note 预编译头随会话的编译选项变化 命令中的头文件路径也随之变化
+ */
+static void gcc_command(void)
+{
+    gcc_argc = 0;
+    gcc_argv[gcc_argc++] = "gcc";
+    for (size_t i = 0; i < sizeof(gcc_flags) / sizeof(gcc_flags[0]); i++)
+        gcc_argv[gcc_argc++] = gcc_flags[i];
+    if (pch_prepare())
+    {
+        gcc_argv[gcc_argc++] = "-include";
+        gcc_argv[gcc_argc++] = pch_header;
+    }
+    const char *tail[] = {"-shared", "-nostdlib", "-Wl,-Bsymbolic", "-x", "c", "-", "-lgcc", "-o"};
+    memcpy(gcc_argv + gcc_argc, tail, sizeof(tail));
+    gcc_argc += sizeof(tail) / sizeof(tail[0]);
+}
+
+static bool gcc_init(void)
+{
+    // 每个缓存项占一个 fd 把软限制提到硬限制
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    cache_open();
+    gcc_command();
+
+    atexit(pool_drain);
+    pool_fill();
+    return pool_count > 0;
+}
+
+/**
+ * @brief 会话的选项改变后重新准备编译命令
+ * @param void
+ * @return 能启动 gcc 返回true
+ * @note 提前启动的 gcc 带着旧的选项 全部结束后按新选项重新启动
+ */
+static bool gcc_configure(void)
+{
+    pool_drain();
+    gcc_command();
+    pool_fill();
+    return pool_count > 0;
+}
+
+/**
+ * @brief 加载 memfd 中的共享库并取得符号
+ * @param fd 存有共享库的 memfd
+ * @param owned 库是否刚编译出来 由模块持有 fd 缓存中的库由缓存持有
+ * @param symbol 符号名
+ * @param module 结果：gcc_module
+ * @return 符号地址 失败时返回NULL
+ * @note 以 RTLD_NOW | RTLD_GLOBAL 加载 未定义的函数在加载时就报错
+ *       而不是调用时终止进程
+ */
+static void *gcc_open(int fd, bool owned, const char *symbol, void **module)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/fd/%d", (int)getpid(), fd);
+    void *handle = dlopen(path, RTLD_NOW | RTLD_GLOBAL);
+    if (handle == NULL)
+    {
+        if (owned)
+            fprintf(stderr, "%s\n", dlerror());
+        return NULL;
+    }
+    void *func = dlsym(handle, symbol);
+    if (func == NULL)
+    {
+        dlclose(handle);
+        return NULL;
+    }
+
+    gcc_module *m = malloc(sizeof(gcc_module));
+    m->handle = handle;
+    m->fd = owned ? fd : -1;
+    *module = m;
+    return func;
+}
+
+/**
+ * @brief 加载刚编译出的共享库 并加入缓存
+ * @param key 缓存键
+ * @param fd 存有共享库的 memfd 失败时关闭
+ * @param symbol 符号名
+ * @param module 结果：gcc_module
+ * @return 符号地址 失败时返回NULL
+ * @note 只缓存能加载的库 未定义符号等错误要在每次输入时重新报告
+ */
+static void *gcc_adopt(unsigned __int128 key, int fd, const char *symbol, void **module)
+{
+    void *func = gcc_open(fd, true, symbol, module);
+    if (func == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+    if (cache_insert(key, fd))
+        ((gcc_module *)*module)->fd = -1;
+    return func;
+}
+
+/**
+ * @brief 从缓存中加载编译结果
+ * @param key 缓存键
+ * @param symbol 符号名
+ * @param module 结果：gcc_module
+ * @return 符号地址 未命中时返回NULL 缓存中的库损坏时也返回NULL 由调用者重新编译
+ * @note none
+ */
+static void *gcc_lookup(unsigned __int128 key, const char *symbol, void **module)
+{
+    int fd = cache_lookup(key);
+    if (fd == -1)
+        return NULL;
+    void *func = gcc_open(fd, false, symbol, module);
+    if (func != NULL)
+        stats.saved_time += stats.misses ? stats.compile_time / stats.misses : 0;
+    return func;
+}
+
+static double elapsed(const struct timespec *t0)
+{
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief 编译源码并取得其中的符号
+ * @param src 源码
+ * @param symbol 符号名
+ * @param flags 追加的编译选项 NULL表示没有
+ * @param module 结果：gcc_module
+ * @return 符号地址 失败时返回NULL
+ * @note 先查缓存
+ */
+static void *gcc_compile(const char *src, const char *symbol, const char *flags, void **module)
+{
+    unsigned __int128 key = cache_key(src, flags);
+    void *func = gcc_lookup(key, symbol, module);
+    if (func != NULL)
+        return func;
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int fd = run_gcc(src, flags);
+    stats.misses++;
+    stats.compile_time += elapsed(&t0);
+    if (fd == -1)
+        return NULL;
+    return gcc_adopt(key, fd, symbol, module);
+}
+
+/**
+ * @brief 并行编译一组源码
+ * @param n 源码数
+ * @param srcs 源码
+ * @param symbol 每段源码中要取的符号
+ * @param addrs 结果：符号地址 失败的为NULL
+ * @param modules 结果：gcc_module
+ * @return void
+ * @note 未命中缓存的源码同时交给多个 gcc 每个 CPU 一个 先用提前启动的进程
+ *       按提交的顺序回收 编译耗时按整组的墙钟时间计入
+ */
+static void gcc_compile_many(int n, char **srcs, const char *symbol, void **addrs, void **modules)
+{
+    unsigned __int128 *keys = malloc(n * sizeof(*keys));
+    int *pending = malloc(n * sizeof(int));
+    int npending = 0;
+    for (int i = 0; i < n; i++)
+    {
+        keys[i] = cache_key(srcs[i], NULL);
+        addrs[i] = gcc_lookup(keys[i], symbol, &modules[i]);
+        if (addrs[i] == NULL)
+            pending[npending++] = i;
+    }
+
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs < 1)
+        jobs = 1;
+    if (jobs > BATCH_JOBS)
+        jobs = BATCH_JOBS;
+    gcc_worker running[BATCH_JOBS];
+    int job_of[BATCH_JOBS];
+    int next = 0, head = 0, count = 0; // running 是环形队列
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pool_fill();
+    while (next < npending || count > 0)
+    {
+        while (count < jobs && next < npending)
+        {
+            gcc_worker w;
+            if (pool_count > 0)
+                w = pool[--pool_count];
+            else if (!worker_spawn(&w, NULL))
+                break;
+            int slot = (head + count++) % jobs;
+            running[slot] = w;
+            job_of[slot] = pending[next++];
+            feed_gcc(w.in, srcs[job_of[slot]]);
+        }
+        if (count == 0)
+            break; // 无法启动 gcc 剩下的都算失败
+
+        gcc_worker w = running[head];
+        int i = job_of[head];
+        head = (head + 1) % jobs;
+        count--;
+        if (wait_gcc(w.pid))
+            addrs[i] = gcc_adopt(keys[i], w.out, symbol, &modules[i]);
+        else
+            close(w.out);
+    }
+    if (npending > 0)
+    {
+        stats.misses += npending;
+        stats.compile_time += elapsed(&t0);
+    }
+    pool_fill();
+    free(keys);
+    free(pending);
+}
+
+static void *gcc_lookup_symbol(void *module, const char *symbol)
+{
+    return dlsym(((gcc_module *)module)->handle, symbol);
+}
+
+static void gcc_release(void *module)
+{
+    gcc_module *m = module;
+    dlclose(m->handle);
+    if (m->fd != -1)
+        close(m->fd);
+    free(m);
+}
+
+// ======================== libtcc 后端 ========================
+
+#ifdef HAVE_LIBTCC
+
+// 直接在内存中编译 不启动进程也不写文件 本身足够快 不经过编译缓存
+// 内存中的代码对动态链接器不可见 跳板表要显式导入
+
+static bool tcc_init(void)
+{
+    return true;
+}
+
+static void *tcc_compile(const char *src, const char *symbol, const char *flags, void **module)
+{
+    TCCState *s = tcc_new();
+    if (s == NULL)
+        return NULL;
+    tcc_set_options(s, "-w");
+    tcc_set_options(s, session_cflags);
+    if (flags != NULL)
+        tcc_set_options(s, flags);
+    tcc_set_output_type(s, TCC_OUTPUT_MEMORY);
+
+    // 链接选项只认 -L 和 -l 库在重定位时载入
+    char *ldflags = strdup(session_ldflags), *save;
+    for (char *t = strtok_r(ldflags, " \t", &save); t; t = strtok_r(NULL, " \t", &save))
+    {
+        if (strncmp(t, "-L", 2) == 0)
+            tcc_add_library_path(s, t + 2);
+        else if (strncmp(t, "-l", 2) == 0)
+            tcc_add_library(s, t + 2);
+    }
+    free(ldflags);
+    if (slots != NULL)
+        tcc_add_symbol(s, SLOTS_SYMBOL, slots);
+
+    // 头文件直接拼在前面 tcc 解析它们的开销可以忽略
+    char *full = malloc(sizeof(prelude_headers) + strlen(src));
+    strcpy(stpcpy(full, prelude_headers), src);
+    int rc = tcc_compile_string(s, full);
+    free(full);
+
+    void *func = NULL;
+    if (rc != -1)
+    {
+#ifdef TCC_RELOCATE_AUTO
+        if (tcc_relocate(s, TCC_RELOCATE_AUTO) >= 0)
+#else
+        if (tcc_relocate(s) >= 0)
+#endif
+            func = tcc_get_symbol(s, symbol);
+    }
+    if (func == NULL)
+    {
+        tcc_delete(s);
+        return NULL;
+    }
+    *module = s;
+    return func;
+}
+
+static void *tcc_lookup_symbol(void *module, const char *symbol)
+{
+    return tcc_get_symbol(module, symbol);
+}
+
+static void tcc_release(void *module)
+{
+    tcc_delete(module);
+}
+
+#endif
+
+static const compile_backend backends[] = {
+#ifdef HAVE_LIBTCC
+    {"tcc", tcc_init, NULL, tcc_compile, NULL, tcc_lookup_symbol, tcc_release},
+#endif
+    {"gcc", gcc_init, gcc_configure, gcc_compile, gcc_compile_many, gcc_lookup_symbol, gcc_release},
+};
+
+/**
+ * @brief 选定并初始化编译后端
+ * @param void
+ * @return 成功返回true
+ * @note 默认用第一个可用的后端 环境变量 CREPL_BACKEND 可以指定
+ *       单元测试不经过 main 因此在第一次编译时才初始化
+ */
+static bool crepl_init(void)
+{
+    if (backend != NULL)
+        return true;
+
+    // gcc 编译失败提前退出时 写管道不应终止 crepl
+    signal(SIGPIPE, SIG_IGN);
+
+    const char *want = getenv("CREPL_BACKEND");
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+    {
+        if (want != NULL && strcmp(want, backends[i].name) != 0)
+            continue;
+        if (backends[i].init())
+        {
+            backend = &backends[i];
+            break;
+        }
+    }
+    if (backend == NULL)
+    {
+        fprintf(stderr, "crepl: no usable compiler backend\n");
+        return false;
+    }
+
+    // 跳板表也由后端编译 这样它对之后加载的模块可见
+    char src[64];
+    snprintf(src, sizeof(src), "void *%s[%d];", SLOTS_SYMBOL, MAX_DEFS);
+    slots = backend->compile(src, SLOTS_SYMBOL, NULL, &slots_module);
+    if (slots == NULL)
+    {
+        fprintf(stderr, "crepl: cannot build the trampoline table\n");
+        backend = NULL;
+        return false;
+    }
+    return true;
+}
+
+// ======================== 会话 ========================
+
+/**
+ * @brief 解析函数定义
+ * @param src 输入的一行
+ * @param name 结果：函数名
+ * @return 函数指针类型 需要 free 不是函数定义时返回NULL
+ * @note 函数名前面是返回类型 只能由标识符、'*' 和空白组成 返回类型不限于 int
+ */
+static char *parse_definition(const char *src, char *name)
+{
+    const char *name_pos = definition_name(src, name);
+    if (name_pos == NULL)
+        return NULL;
+    const char *p = src;
+    while (p < name_pos && (isalnum((unsigned char)*p) || *p == '_' || *p == '*' || isspace((unsigned char)*p)))
+        p++;
+    if (p < name_pos || strspn(src, " \t") == (size_t)(name_pos - src))
+        return NULL;
+    return definition_type(src, name_pos, strlen(name));
+}
+
+/**
+ * @brief 判断一行是否是类型声明
+ * @param line 输入的一行
+ * @return 是 struct、union、enum 或 typedef 声明时返回true
+ * @note 声明以分号结尾 函数定义已先行排除
+ */
+static bool is_declaration(const char *line)
+{
+    static const char *const keywords[] = {"struct", "union", "enum", "typedef"};
+    size_t len = strlen(line);
+    while (len > 0 && isspace((unsigned char)line[len - 1]))
+        len--;
+    if (len == 0 || line[len - 1] != ';')
+        return false;
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++)
+    {
+        size_t n = strlen(keywords[i]);
+        if (strncmp(line, keywords[i], n) == 0 && !isalnum((unsigned char)line[n]) && line[n] != '_')
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief 生成表达式的包装函数
+ * @param symbol 函数名
+ * @param expression 表达式
+ * @return 函数的源码 需要 free
+ * @note 包装函数把结果的类型、大小和字节写给调用者 由 crepl 按类型输出
+ *       _Generic 只求值选中的一支 表达式写了三次 但只求值一次
+ *       (__typeof__(e) *)0 在 e 是 void 时也合法 借此区分 void 表达式
+ */
+static char *expression_wrapper(const char *symbol, const char *expression)
+{
+    static const char fmt[] =
+        "void %1$s(int *__crepl_kind, __SIZE_TYPE__ *__crepl_size, void *__crepl_bytes)\n"
+        "{\n"
+        "    _Generic((__typeof__(%2$s) *)0, void *: (%2$s), default: (void)0);\n"
+        "    __auto_type __crepl_v = _Generic((__typeof__(%2$s) *)0, void *: 0, default: (%2$s));\n"
+        "    *__crepl_kind = _Generic((__typeof__(%2$s) *)0, void *: %3$d, default:\n"
+        "        _Generic(__crepl_v, _Bool: %4$d, char: %5$d,\n"
+        "                 signed char: %6$d, short: %6$d, int: %6$d, long: %6$d, long long: %6$d,\n"
+        "                 unsigned char: %7$d, unsigned short: %7$d, unsigned: %7$d,\n"
+        "                 unsigned long: %7$d, unsigned long long: %7$d,\n"
+        "                 float: %8$d, double: %8$d, long double: %8$d,\n"
+        "                 char *: %9$d, const char *: %9$d,\n"
+        "                 default: __crepl_is_pointer(__crepl_v) ? %10$d : %11$d));\n"
+        "    *__crepl_size = sizeof(__crepl_v);\n"
+        "    __builtin_memcpy(__crepl_bytes, &__crepl_v, sizeof(__crepl_v) < %12$d ? sizeof(__crepl_v) : %12$d);\n"
+        "}\n";
+    size_t len = sizeof(fmt) + strlen(symbol) + 3 * strlen(expression) + 64;
+    char *wrapper = malloc(len);
+    snprintf(wrapper, len, fmt, symbol, expression, VALUE_VOID, VALUE_BOOL, VALUE_CHAR, VALUE_INT,
+             VALUE_UINT, VALUE_FLOAT, VALUE_STRING, VALUE_POINTER, VALUE_OBJECT, VALUE_BYTES);
+    return wrapper;
+}
+
+/**
+ * @brief 生成表达式的完整源码
+ * @param expression 表达式
+ * @return 完整的源码 需要 free
+ * @note 包装函数名固定 相同的表达式得到相同的源码 可以命中编译缓存
+ */
+static char *expression_source(const char *expression)
+{
+    char *wrapper = expression_wrapper(EXPR_SYMBOL, expression);
+    char *src = with_prelude(wrapper, NULL);
+    free(wrapper);
+    return src;
+}
+
+/**
+ * @brief 编译并加载一个函数定义
+ * @param function_def 函数定义
+ * @return 成功返回true
+ * @note 只编译这一个定义 代价与会话中已有多少函数无关
+ *       同名函数编译出新版本并更新跳板槽 旧版本的模块不卸载 可能仍有代码在执行它
+ */
+bool compile_and_load_function(const char *function_def)
+{
+    char name[MAX_NAME];
+    char *type = parse_definition(function_def, name);
+    if (type == NULL)
+        return false;
+    if (!crepl_init())
+    {
+        free(type);
+        return false;
+    }
+
+    int idx = find_definition(name);
+    if (idx < 0 && def_count == MAX_DEFS)
+    {
+        free(type);
+        return false;
+    }
+
+    // 先编译 成功后才改动定义表
+    definition next = {0};
+    strcpy(next.name, name);
+    char *src = with_prelude(function_def, &next);
+    next.addr = backend->compile(src, DEF_SYMBOL, NULL, &next.module);
+    free(src);
+    if (next.addr == NULL)
+    {
+        free(type);
+        return false;
+    }
+
+    next.src = strdup(function_def);
+    next.type = type;
+    next.int_arity = int_arity(type);
+    if (idx >= 0)
+    {
+        free(defs[idx].src);
+        free(defs[idx].type);
+    }
+    else
+    {
+        idx = def_count++;
+    }
+    defs[idx] = next;
+    slots[idx] = next.addr;
+    return true;
+}
+
+typedef void (*expr_func)(int *kind, size_t *size, void *bytes);
+
+/**
+ * @brief 求值表达式 结果带类型
+ * @param expression 表达式
+ * @param value 结果
+ * @return 成功返回true
+ * @note 纯 int 运算先走快速路径
+ */
+bool evaluate_value(const char *expression, crepl_value *value)
+{
+    // 纯算术和对 int 函数的调用直接解释执行
+    int result;
+    fast_status fast = fast_evaluate(expression, &result);
+    if (fast != FAST_UNSUPPORTED)
+    {
+        stats.fast++;
+        value->kind = VALUE_INT;
+        value->size = sizeof(int);
+        memcpy(value->bytes, &result, sizeof(int));
+        return fast == FAST_OK;
+    }
+
+    if (!crepl_init())
+        return false;
+
+    // 编译并取得函数指针
+    void *module;
+    char *src = expression_source(expression);
+    expr_func func = (expr_func)backend->compile(src, EXPR_SYMBOL, NULL, &module);
+    free(src);
+    if (!func)
+    {
+        return false;
+    }
+
+    // 调用函数获取结果
+    int kind;
+    func(&kind, &value->size, value->bytes);
+    value->kind = kind;
+
+    // 清理资源
+    backend->release(module);
+    return true;
+}
+
+/**
+ * @brief 把整数或浮点数结果转换成 long double
+ * @param value 结果
+ * @param out 转换后的值
+ * @return 是数值时返回true
+ * @note none
+ */
+static bool value_number(const crepl_value *value, long double *out)
+{
+    union
+    {
+        unsigned char bytes[VALUE_BYTES];
+        int8_t i8;
+        int16_t i16;
+        int32_t i32;
+        int64_t i64;
+        uint8_t u8;
+        uint16_t u16;
+        uint32_t u32;
+        uint64_t u64;
+        float f;
+        double d;
+        long double ld;
+    } v;
+    memcpy(v.bytes, value->bytes, VALUE_BYTES);
+    switch (value->kind)
+    {
+    case VALUE_INT:
+    case VALUE_CHAR:
+        *out = value->size == 1 ? v.i8 : value->size == 2 ? v.i16 : value->size == 4 ? v.i32 : v.i64;
+        return true;
+    case VALUE_UINT:
+    case VALUE_BOOL:
+        *out = value->size == 1 ? v.u8 : value->size == 2 ? v.u16 : value->size == 4 ? v.u32 : v.u64;
+        return true;
+    case VALUE_FLOAT:
+        *out = value->size == sizeof(float) ? v.f : value->size == sizeof(double) ? v.d : v.ld;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Evaluate an expression
+bool evaluate_expression(const char *expression, int *result)
+{
+    // 数值结果按 C 的规则转换成 int 指针、结构体和 void 没有 int 值
+    crepl_value value;
+    long double number;
+    if (!evaluate_value(expression, &value) || !value_number(&value, &number))
+        return false;
+    if (value.kind == VALUE_FLOAT)
+        *result = (int)number;
+    else
+        *result = (int)(long long)(value.kind == VALUE_UINT ? (long double)(unsigned long long)number : number);
+    return true;
+}
+
+/**
+ * @brief 按类型格式化表达式的结果
+ * @param value 结果
+ * @param buf 输出缓冲区
+ * @param size 缓冲区大小
+ * @return void
+ * @note 浮点数输出能还原出原值的最短形式 整数形式的浮点数补上 .0
+ *       字符串转义不可打印的字符 超过 STRING_PREVIEW 个字符时截断
+ */
+static void format_value(const crepl_value *value, char *buf, size_t size)
 {
-    char *cmd[128];
-    int tk_cnt = 0;
+    long double number;
+    const void *ptr;
+    memcpy(&ptr, value->bytes, sizeof(ptr));
 
-    char *tk = strtok(input, " ");
-    while (tk != NULL && tk_cnt < 32)
+    switch (value->kind)
+    {
+    case VALUE_VOID:
+        snprintf(buf, size, "(void)");
+        break;
+    case VALUE_BOOL:
+        snprintf(buf, size, "%s", value->bytes[0] ? "true" : "false");
+        break;
+    case VALUE_CHAR:
+        if (isprint(value->bytes[0]))
+            snprintf(buf, size, "'%c'", value->bytes[0]);
+        else
+            snprintf(buf, size, "'\\x%02x'", value->bytes[0]);
+        break;
+    case VALUE_INT:
+        value_number(value, &number);
+        snprintf(buf, size, "%lld", (long long)number);
+        break;
+    case VALUE_UINT:
+        value_number(value, &number);
+        snprintf(buf, size, "%llu", (unsigned long long)number);
+        break;
+    case VALUE_FLOAT:
+    {
+        value_number(value, &number);
+        int digits = value->size == sizeof(float) ? 6 : value->size == sizeof(double) ? 15 : 18;
+        for (int max = digits + 3; digits < max; digits++)
+        {
+            snprintf(buf, size, "%.*Lg", digits, number);
+            long double back = strtold(buf, NULL);
+            if (value->size == sizeof(float) ? (float)back == (float)number
+                : value->size == sizeof(double) ? (double)back == (double)number
+                                                : back == number)
+                break;
+        }
+        if (strspn(buf, "-0123456789") == strlen(buf))
+            strncat(buf, ".0", size - strlen(buf) - 1);
+        break;
+    }
+    case VALUE_STRING:
     {
-        cmd[tk_cnt++] = tk;
-        tk = strtok(NULL, " ");
+        if (ptr == NULL)
+        {
+            snprintf(buf, size, "NULL");
+            break;
+        }
+        const unsigned char *s = ptr;
+        size_t off = snprintf(buf, size, "\"");
+        int n = 0;
+        for (; s[n] != '\0' && n < STRING_PREVIEW && off + 8 < size; n++)
+        {
+            if (s[n] == '"' || s[n] == '\\')
+                off += snprintf(buf + off, size - off, "\\%c", s[n]);
+            else if (s[n] == '\n' || s[n] == '\t')
+                off += snprintf(buf + off, size - off, "\\%c", s[n] == '\n' ? 'n' : 't');
+            else if (isprint(s[n]))
+                buf[off++] = s[n];
+            else
+                off += snprintf(buf + off, size - off, "\\x%02x", s[n]);
+        }
+        snprintf(buf + off, size - off, s[n] != '\0' ? "\"..." : "\"");
+        break;
+    }
+    case VALUE_POINTER:
+        snprintf(buf, size, "%p", (void *)ptr);
+        break;
+    default:
+    {
+        size_t off = snprintf(buf, size, "(%zu-byte object:", value->size);
+        size_t n = value->size < VALUE_BYTES ? value->size : VALUE_BYTES;
+        for (size_t i = 0; i < n && off < size; i++)
+            off += snprintf(buf + off, size - off, " %02x", value->bytes[i]);
+        if (off < size)
+            snprintf(buf + off, size - off, value->size > VALUE_BYTES ? " ...)" : ")");
+        break;
+    }
     }
-    cmd[tk_cnt] = NULL; // 添加终止符
+}
 
-    pid_t pid = fork();
+/**
+ * @brief 输出表达式的结果
+ * @param value 结果
+ * @return void
+ * @note void 表达式不输出
+ */
+static void print_value(const crepl_value *value)
+{
+    if (value->kind == VALUE_VOID)
+        return;
+    char buf[4 * STRING_PREVIEW + 64];
+    format_value(value, buf, sizeof(buf));
+    printf("Result: %s\n", buf);
+}
 
-    if (pid == -1)
+/**
+ * @brief 加入一个类型声明
+ * @param decl 声明
+ * @return 成功返回true
+ * @note 先连同已有的声明编译一次 能编译才加入
+ */
+static bool declare(const char *decl)
+{
+    if (!crepl_init())
+        return false;
+    size_t len = (decls ? strlen(decls) : 0) + strlen(decl) + 2;
+    char *next = malloc(len);
+    snprintf(next, len, "%s%s\n", decls ? decls : "", decl);
+
+    char *old = decls;
+    decls = next;
+    char body[sizeof(UNIT_SYMBOL) + 16];
+    snprintf(body, sizeof(body), "char %s;\n", UNIT_SYMBOL);
+    char *src = with_prelude(body, NULL);
+    void *module;
+    bool ok = backend->compile(src, UNIT_SYMBOL, NULL, &module) != NULL;
+    free(src);
+    if (ok)
     {
-        perror("fork");
-        return 1;
+        backend->release(module);
+        free(old);
+    }
+    else
+    {
+        decls = old;
+        free(next);
+    }
+    return ok;
+}
+
+// ======================== 批处理 ========================
+
+// 脚本中连续的定义或表达式合成几个编译单元 各单元同时编译 每个单元只启动一次编译器
+// 每个片段导出自己的符号 前缀加上片段的序号 如 __crepl_self_3
+
+/**
+ * @brief 编译一组片段 每 per_unit 个片段合成一个编译单元
+ * @param n 要编译的片段数
+ * @param which 要编译的片段的序号
+ * @param parts 全部片段 第 k 个片段定义符号 prefix_k
+ * @param prefix 符号名前缀
+ * @param per_unit 每个单元的片段数
+ * @param addrs 结果：按序号存放符号地址 所在单元编译失败时为NULL
+ * @param modules 结果：按序号存放所在单元的模块 同一单元的片段共用一个
+ * @return void
+ * @note 单元末尾定义 UNIT_SYMBOL 编译时取它确认模块可用
+ */
+static void compile_pass(int n, const int *which, char **parts, const char *prefix, int per_unit,
+                         void **addrs, void **modules)
+{
+    int nunits = (n + per_unit - 1) / per_unit;
+    char **srcs = malloc(nunits * sizeof(char *));
+    void **first = malloc(nunits * sizeof(void *));
+    void **units = malloc(nunits * sizeof(void *));
+    for (int u = 0; u < nunits; u++)
+    {
+        int begin = u * per_unit, end = begin + per_unit < n ? begin + per_unit : n;
+        size_t len = sizeof(UNIT_SYMBOL) + 16;
+        for (int i = begin; i < end; i++)
+            len += strlen(parts[which[i]]);
+        char *body = malloc(len), *p = body;
+        for (int i = begin; i < end; i++)
+            p = stpcpy(p, parts[which[i]]);
+        sprintf(p, "char %s;\n", UNIT_SYMBOL);
+        srcs[u] = with_prelude(body, NULL);
+        free(body);
+    }
+
+    if (backend->compile_many != NULL)
+    {
+        backend->compile_many(nunits, srcs, UNIT_SYMBOL, first, units);
+    }
+    else
+    {
+        for (int u = 0; u < nunits; u++)
+            first[u] = backend->compile(srcs[u], UNIT_SYMBOL, NULL, &units[u]);
     }
-    else if (pid == 0)
+
+    char symbol[MAX_NAME + 16];
+    for (int u = 0; u < nunits; u++)
     {
-        // 子进程
-        if (execvp("gcc", cmd) == -1)
+        free(srcs[u]);
+        int begin = u * per_unit, end = begin + per_unit < n ? begin + per_unit : n;
+        for (int i = begin; i < end; i++)
         {
-            return -1;
+            int k = which[i];
+            snprintf(symbol, sizeof(symbol), "%s_%d", prefix, k);
+            addrs[k] = first[u] ? backend->lookup(units[u], symbol) : NULL;
+            modules[k] = first[u] ? units[u] : NULL;
         }
     }
-    else
+    free(srcs);
+    free(first);
+    free(units);
+}
+
+/**
+ * @brief 编译一组片段
+ * @param n 片段数
+ * @param parts 片段 第 k 个片段定义符号 prefix_k
+ * @param prefix 符号名前缀
+ * @param addrs 结果：符号地址 编译失败的为NULL
+ * @param modules 结果：所在单元的模块 交给 release_units 释放
+ * @return void
+ * @note 先按 UNIT_PARTS 个一组编译 失败的单元再把其中的片段逐个编译
+ *       这样一个错误只让所在单元的片段多编译一次 而不会拖累整个脚本
+ */
+static void compile_units(int n, char **parts, const char *prefix, void **addrs, void **modules)
+{
+    int *which = calloc(n, sizeof(int));
+    for (int k = 0; k < n; k++)
+        which[k] = k;
+    compile_pass(n, which, parts, prefix, UNIT_PARTS, addrs, modules);
+
+    int retry = 0;
+    for (int k = 0; k < n; k++)
+    {
+        if (addrs[k] == NULL)
+            which[retry++] = k;
+    }
+    if (retry > 0 && n > 1)
+        compile_pass(retry, which, parts, prefix, 1, addrs, modules);
+    free(which);
+}
+
+static void release_units(int n, void **modules)
+{
+    for (int k = 0; k < n; k++)
+    {
+        if (modules[k] != NULL && (k == 0 || modules[k] != modules[k - 1]))
+            backend->release(modules[k]);
+    }
+}
+
+/**
+ * @brief 生成定义在编译单元中的片段
+ * @param line 定义
+ * @param slot 定义在跳板表中的下标
+ * @param k 片段序号
+ * @return 片段 需要 free
+ * @note 片段内函数名映射到自己的符号 递归调用不经过跳板 片段之后恢复为经跳板的调用
+ *       同一单元中其他定义对它的调用仍经过跳板 以后重新定义时随之更新
+ */
+static char *definition_part(const char *line, int slot, int k)
+{
+    const definition *def = &defs[slot];
+    size_t len = strlen(line) + 4 * strlen(def->name) + strlen(def->type) + 128;
+    char *part = malloc(len);
+    snprintf(part, len, "#undef %s\n#define %s %s_%d\n%s\n#undef %s\n#define %s (*(%s)%s[%d])\n",
+             def->name, def->name, DEF_SYMBOL, k, line, def->name, def->name, def->type,
+             SLOTS_SYMBOL, slot);
+    return part;
+}
+
+/**
+ * @brief 编译并加载一组函数定义
+ * @param lines 定义 函数名互不相同
+ * @param n 定义数
+ * @return 失败的定义数 每个失败的定义输出一行 error
+ * @note 先把整组的名字和类型登记进定义表 各定义的源码只依赖这些 可以同时编译
+ *       组内的定义可以互相调用 有定义失败时撤销登记 去掉失败的定义后再编译一轮
+ *       调用了失败定义的定义在下一轮中失败 结果与逐行输入相同
+ */
+static int define_many(char **lines, int n)
+{
+    bool *ok = malloc(n * sizeof(bool));
+    for (int k = 0; k < n; k++)
+        ok[k] = true;
+    bool done = !crepl_init() || def_count + n > MAX_DEFS;
+    if (done)
+    {
+        for (int k = 0; k < n; k++)
+            ok[k] = compile_and_load_function(lines[k]);
+    }
+
+    int *idx = malloc(n * sizeof(int));
+    char **old_types = malloc(n * sizeof(char *));
+    char **parts = malloc(n * sizeof(char *));
+    char **active = malloc(n * sizeof(char *));
+    void **addrs = malloc(n * sizeof(void *));
+    void **modules = malloc(n * sizeof(void *));
+    while (!done)
     {
-        // 父进程
-        int status;
-        if (waitpid(pid, &status, 0) == -1)
+        // 登记这一轮参与编译的定义
+        int base = def_count, m = 0;
+        for (int k = 0; k < n; k++)
         {
-            return -1;
+            if (!ok[k])
+                continue;
+            char name[MAX_NAME];
+            char *type = parse_definition(lines[k], name);
+            int i = find_definition(name);
+            old_types[m] = NULL;
+            if (i < 0)
+            {
+                i = def_count++;
+                defs[i] = (definition){.int_arity = -1};
+                strcpy(defs[i].name, name);
+            }
+            else
+            {
+                old_types[m] = defs[i].type;
+            }
+            defs[i].type = type;
+            idx[m] = i;
+            active[m++] = lines[k];
         }
-        if (WIFEXITED(status))
+        if (m == 0)
+            break;
+        for (int j = 0; j < m; j++)
+            parts[j] = definition_part(active[j], idx[j], j);
+        compile_units(m, parts, DEF_SYMBOL, addrs, modules);
+
+        done = true;
+        for (int j = 0; j < m; j++)
+            done = done && addrs[j] != NULL;
+        for (int j = 0; j < m; j++)
         {
-            int exit_code = WEXITSTATUS(status);
-            if (exit_code != 0)
+            definition *def = &defs[idx[j]];
+            free(parts[j]);
+            if (done)
+            {
+                free(old_types[j]);
+                free(def->src);
+                def->src = strdup(active[j]);
+                def->int_arity = int_arity(def->type);
+                def->addr = addrs[j];
+                def->module = modules[j];
+                slots[idx[j]] = addrs[j];
+            }
+            else
             {
-                return -1;
+                free(def->type);
+                def->type = old_types[j];
             }
         }
+        if (done)
+            break;
+
+        // 撤销登记 这些模块还没有被执行过 可以直接卸载
+        def_count = base;
+        release_units(m, modules);
+        for (int k = 0, j = 0; k < n; k++)
+        {
+            if (ok[k])
+                ok[k] = addrs[j++] != NULL;
+        }
     }
+    free(idx);
+    free(old_types);
+    free(parts);
+    free(active);
+    free(addrs);
+    free(modules);
 
-    return 0;
+    int failed = 0;
+    for (int k = 0; k < n; k++)
+    {
+        if (!ok[k])
+        {
+            printf("error\n");
+            failed++;
+        }
+    }
+    free(ok);
+    return failed;
 }
 
-bool compile_and_load_function(const char *function_def)
+/**
+ * @brief 按顺序求值一组表达式
+ * @param lines 表达式
+ * @param n 表达式数
+ * @return 失败的表达式数
+ * @note 快速路径处理不了的表达式先一起编译 再按顺序执行并输出结果
+ *       表达式经跳板表调用函数 编译的先后不影响执行时看到的定义
+ */
+static int evaluate_many(char **lines, int n)
 {
-    if (strncmp(function_def, "int", 3) != 0)
+    int *which = malloc(n * sizeof(int));
+    char **parts = malloc(n * sizeof(char *));
+    void **addrs = malloc(n * sizeof(void *));
+    void **modules = malloc(n * sizeof(void *));
+    int m = 0;
+    for (int k = 0; k < n; k++)
     {
-        return false;
+        if (!fast_supported(lines[k]))
+        {
+            char symbol[sizeof(EXPR_SYMBOL) + 16];
+            snprintf(symbol, sizeof(symbol), "%s_%d", EXPR_SYMBOL, m);
+            parts[m] = expression_wrapper(symbol, lines[k]);
+            which[m++] = k;
+        }
     }
+    if (m > 0 && crepl_init())
+        compile_units(m, parts, EXPR_SYMBOL, addrs, modules);
+    else
+        memset(addrs, 0, m * sizeof(void *));
 
-    // 生成临时C文件
-    char c_temp_path[] = "/tmp/crepl_XXXXXX.c";
-    int c_fd = mkstemps(c_temp_path, 2);
-    if (c_fd == -1)
+    int failed = 0;
+    for (int k = 0, j = 0; k < n; k++)
     {
-        return false;
+        bool ok;
+        crepl_value value;
+        if (j < m && which[j] == k)
+        {
+            ok = addrs[j] != NULL;
+            if (ok)
+            {
+                int kind;
+                ((expr_func)addrs[j])(&kind, &value.size, value.bytes);
+                value.kind = kind;
+            }
+            free(parts[j++]);
+        }
+        else
+        {
+            ok = evaluate_value(lines[k], &value);
+        }
+
+        if (ok)
+        {
+            print_value(&value);
+        }
+        else
+        {
+            printf("error\n");
+            failed++;
+        }
     }
-    int rc = write(c_fd, function_def, strlen(function_def));
-    if (rc < 0)
+    if (m > 0 && backend != NULL)
+        release_units(m, modules);
+    free(which);
+    free(parts);
+    free(addrs);
+    free(modules);
+    return failed;
+}
+
+static bool is_definition(const char *line, char *name)
+{
+    char *type = parse_definition(line, name);
+    free(type);
+    return type != NULL;
+}
+
+/**
+ * @brief 批处理执行脚本
+ * @param fp 脚本 每行一个定义、表达式或命令
+ * @return 所有行都成功返回0 否则返回1
+ * @note 连续的定义并行编译 连续的表达式中需要编译的也并行编译 之后按顺序执行
+ *       输出与交互模式相同 但没有提示符和每行的编译耗时
+ */
+static int run_script(FILE *fp)
+{
+    // 读入所有非空行
+    char **lines = NULL;
+    int n = 0, cap = 0;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    while ((len = getline(&line, &size, fp)) != -1)
     {
-        return false;
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0)
+            continue;
+        if (n == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            lines = realloc(lines, cap * sizeof(char *));
+        }
+        lines[n++] = strdup(line);
+    }
+    free(line);
+
+    char (*names)[MAX_NAME] = malloc((n + 1) * sizeof(*names));
+    int failed = 0;
+    for (int i = 0; i < n;)
+    {
+        int j = i + 1;
+        if (lines[i][0] == ':' || is_declaration(lines[i]))
+        {
+            if (lines[i][0] == ':' ? !run_command(lines[i] + 1) : !declare(lines[i]))
+            {
+                printf("error\n");
+                failed++;
+            }
+            rebuild_poll(true);
+        }
+        else if (is_definition(lines[i], names[i]))
+        {
+            // 一组连续的定义 遇到重名时截断 重定义要等前一个版本装入后再编译
+            for (; j < n && lines[j][0] != ':' && is_definition(lines[j], names[j]); j++)
+            {
+                int k = i;
+                while (k < j && strcmp(names[k], names[j]) != 0)
+                    k++;
+                if (k < j)
+                    break;
+            }
+            failed += define_many(lines + i, j - i);
+        }
+        else
+        {
+            while (j < n && lines[j][0] != ':' && !is_declaration(lines[j]) &&
+                   !is_definition(lines[j], names[j]))
+                j++;
+            failed += evaluate_many(lines + i, j - i);
+        }
+        i = j;
     }
 
-    close(c_fd);
+    for (int i = 0; i < n; i++)
+        free(lines[i]);
+    free(lines);
+    free(names);
+    return failed ? 1 : 0;
+}
+
+// ======================== 基准测试 ========================
 
-    // 编译临时文件
-    char input[128];
-    snprintf(input, sizeof(input),
-             "gcc -shared -fPIC -o /tmp/crepl_temp.so %s -w",
-             c_temp_path);
-    int status = exe_cmd(input);
+// :bench [选项...] 表达式 [迭代次数]
+// 表达式连同会话中的所有定义按每个 -O 级别各编译一次 在计时循环中反复执行
 
-    // 删除临时C文件
-    unlink(c_temp_path);
+/**
+ * @brief 生成基准测试的源码
+ * @param expression 表达式
+ * @return 完整的源码 需要 free
+ * @note 会话中的定义以 static 函数的形式编进同一个单元 与表达式一起按测试的选项优化
+ *       函数名映射到单元内的名字 不经过跳板表 编译器可以内联
+ *       每次迭代的结果经空的内联汇编取地址 编译器不能删掉它 但仍可能把它提到循环外
+ */
+static char *bench_source(const char *expression)
+{
+    static const char fmt[] =
+        "void %1$s(long __crepl_n)\n"
+        "{\n"
+        "    for (long __crepl_i = 0; __crepl_i < __crepl_n; __crepl_i++)\n"
+        "    {\n"
+        "        _Generic((__typeof__(%2$s) *)0, void *: (%2$s), default: (void)0);\n"
+        "        __auto_type __crepl_v = _Generic((__typeof__(%2$s) *)0, void *: 0, default: (%2$s));\n"
+        "        __asm__ volatile(\"\" : : \"r\"(&__crepl_v) : \"memory\");\n"
+        "    }\n"
+        "}\n"
+        "void %1$s_empty(long __crepl_n)\n"
+        "{\n"
+        "    for (long __crepl_i = 0; __crepl_i < __crepl_n; __crepl_i++)\n"
+        "        __asm__ volatile(\"\" : : : \"memory\");\n"
+        "}\n";
+    size_t len = sizeof(fmt) + 2 * sizeof(BENCH_SYMBOL) + 4 * strlen(expression) +
+                 (decls ? strlen(decls) : 0);
+    for (int i = 0; i < def_count; i++)
+        len += strlen(defs[i].src) + strlen(defs[i].type) + 3 * MAX_NAME + 64;
 
-    if (status == -1 || WEXITSTATUS(status) != 0)
+    char *src = malloc(len);
+    size_t off = sprintf(src, "%s", decls ? decls : "");
+    for (int i = 0; i < def_count; i++)
+        off += sprintf(src + off, "#define %s %s_%d\n", defs[i].name, BENCH_SYMBOL, i);
+    // 先声明全部函数 定义之间的调用与顺序无关
+    for (int i = 0; i < def_count; i++)
     {
-        return false;
+        const char *star = strstr(defs[i].type, "(*)");
+        off += sprintf(src + off, "static %.*s%s%s;\n", (int)(star - defs[i].type), defs[i].type,
+                       defs[i].name, star + 3);
+    }
+    for (int i = 0; i < def_count; i++)
+        off += sprintf(src + off, "static %s\n", defs[i].src);
+    snprintf(src + off, len - off, fmt, BENCH_SYMBOL, expression);
+    return src;
+}
+
+typedef void (*bench_func)(long n);
+
+static double bench_time(bench_func f, long n)
+{
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    f(n);
+    return elapsed(&t0) * 1e9;
+}
+
+/**
+ * @brief 测量一个优化级别
+ * @param loop 计时循环
+ * @param empty 空循环
+ * @param iterations 每个样本的迭代次数 为0时自动确定
+ * @param r 结果
+ * @return void
+ * @note 先执行一次预热缓存和分支预测 自动确定时把迭代次数翻倍到一个样本至少 BENCH_SAMPLE_NS
+ *       每个样本之后紧接着测一次空循环 扣除循环本身和计时的开销
+ */
+static void bench_measure(bench_func loop, bench_func empty, long iterations, bench_result *r)
+{
+    long n = iterations;
+    loop(1);
+    if (n <= 0)
+    {
+        for (n = 1; n < LONG_MAX / 2 && bench_time(loop, n) < BENCH_SAMPLE_NS; n *= 2)
+            ;
     }
 
-    // 将函数定义添加到汇总文件
-    FILE *summary_file = fopen("/tmp/crepl_summary.c", "a");
-    if (!summary_file)
+    double sum = 0, sq = 0, min = 0, base = 0;
+    for (int i = 0; i < BENCH_SAMPLES; i++)
     {
-        return false;
+        double t = bench_time(loop, n) / n;
+        base += bench_time(empty, n) / n;
+        sum += t;
+        sq += t * t;
+        if (i == 0 || t < min)
+            min = t;
     }
-    fprintf(summary_file, "%s\n", function_def);
-    fclose(summary_file);
+    double mean = sum / BENCH_SAMPLES;
+    base /= BENCH_SAMPLES;
+    r->mean = mean > base ? mean - base : 0;
+    r->min = min > base ? min - base : 0;
+    r->stddev = sq / BENCH_SAMPLES > mean * mean ? sqrt(sq / BENCH_SAMPLES - mean * mean) : 0;
+    r->iterations = n;
+}
 
-    // 编译汇总文件成共享库
-    snprintf(input, sizeof(input),
-             "gcc -shared -fPIC -o /tmp/crepl.so /tmp/crepl_summary.c -w -Wredundant-decls");
-    status = exe_cmd(input);
+/**
+ * @brief 从 :bench 的表达式末尾分出迭代次数
+ * @param expression 表达式 原地去掉末尾的空白和迭代次数
+ * @return 迭代次数 没有给出时返回0 表示自动确定
+ * @note 最后一个词是整数 且前面不是运算符时才算迭代次数 如 f(1) 100 是 但 x - 100 不是
+ */
+long bench_iterations(char *expression)
+{
+    long iterations = 0;
+    char *end = expression + strlen(expression);
+    while (end > expression && isspace((unsigned char)end[-1]))
+        *--end = '\0';
+    char *last = end;
+    while (last > expression && isdigit((unsigned char)last[-1]))
+        last--;
+    if (last < end && last > expression && isspace((unsigned char)last[-1]))
+    {
+        char *before = last;
+        while (before > expression && isspace((unsigned char)before[-1]))
+            before--;
+        if (before > expression && strchr("+-*/%&|^<>=!~?:,(", before[-1]) == NULL)
+        {
+            iterations = atol(last);
+            *before = '\0';
+        }
+    }
+    return iterations;
+}
 
-    if (status == -1 || WEXITSTATUS(status) != 0)
+/**
+ * @brief 执行 :bench 命令
+ * @param args 命令的参数
+ * @return 至少一个级别测量成功时返回true
+ * @note 开头以 - 加字母开头且不含括号的词是选项 -O 开头的每个是一个要比较的级别
+ *       其他选项加到每个级别上 没有给出级别时比较 BENCH_LEVELS
+ *       末尾的迭代次数由 bench_iterations 分出
+ */
+static bool bench_command(const char *args)
+{
+    char *copy = strdup(args);
+    char *levels[BENCH_MAX_LEVELS];
+    int nlevels = 0;
+    char flags[1024] = BENCH_FLAGS;
+    char *p = copy;
+    while (true)
+    {
+        while (isspace((unsigned char)*p))
+            p++;
+        size_t n = strcspn(p, " \t");
+        if (p[0] != '-' || !isalpha((unsigned char)p[1]) || memchr(p, '(', n) || memchr(p, ')', n))
+            break;
+        char *word = p;
+        p += n;
+        if (*p != '\0')
+            *p++ = '\0';
+        if (strncmp(word, "-O", 2) == 0 && nlevels < BENCH_MAX_LEVELS)
+            levels[nlevels++] = word;
+        else if (strncmp(word, "-O", 2) != 0)
+            snprintf(flags + strlen(flags), sizeof(flags) - strlen(flags), " %s", word);
+    }
+    char *expression = p;
+    long iterations = bench_iterations(expression);
+    if (*expression == '\0' || !crepl_init())
     {
+        if (*expression == '\0')
+            fprintf(stderr, "Usage: :bench [-O0 -O2 ...] [flags] expr [iterations]\n");
+        free(copy);
         return false;
     }
 
-    return true;
+    char defaults[] = BENCH_LEVELS;
+    if (nlevels == 0)
+    {
+        char *save;
+        for (char *t = strtok_r(defaults, " ", &save); t && nlevels < BENCH_MAX_LEVELS;
+             t = strtok_r(NULL, " ", &save))
+            levels[nlevels++] = t;
+    }
+
+    char *src = bench_source(expression);
+    bool any = false;
+    printf("%-8s %12s %10s %12s %16s\n", "level", "ns/op", "stddev", "min", "iterations");
+    for (int i = 0; i < nlevels; i++)
+    {
+        char level_flags[sizeof(flags) + 64];
+        snprintf(level_flags, sizeof(level_flags), "%s %s", flags, levels[i]);
+        void *module;
+        bench_func loop = (bench_func)backend->compile(src, BENCH_SYMBOL, level_flags, &module);
+        bench_func empty = loop ? (bench_func)backend->lookup(module, BENCH_SYMBOL "_empty") : NULL;
+        if (empty == NULL)
+        {
+            // 各级别的源码相同 编译错误会重复出现 只报告一次
+            printf("%-8s %12s\n", levels[i], "error");
+            if (loop != NULL)
+                backend->release(module);
+            break;
+        }
+
+        bench_result r;
+        bench_measure(loop, empty, iterations, &r);
+        printf("%-8s %12.2f %10.2f %12.2f %11ld x %-2d%s\n", levels[i], r.mean, r.stddev, r.min,
+               r.iterations, BENCH_SAMPLES,
+               r.mean < BENCH_NOISE_NS ? "  (optimized away or hoisted out of the loop?)" : "");
+        backend->release(module);
+        any = true;
+    }
+    free(src);
+    free(copy);
+    return any;
 }
 
-// Evaluate an expression
-bool evaluate_expression(const char *expression, int *result)
-{
-    expr_counter++; // 计数器递增
-    char func_name[64];
-    snprintf(func_name, sizeof(func_name), "__expr_wrapper_%d", expr_counter); // 生成唯一函数名
+// ======================== 编译选项 ========================
+
+// :set cflags 选项... / :set ldflags 选项... 改变之后所有定义和表达式的编译选项
+// 已有的定义在后台用新选项重新编译 完成后在处理下一行输入前换进跳板表
 
-    // 构造带唯一函数名的代码
-    char function_def[1024];
-    snprintf(function_def, sizeof(function_def),
-             "int %s() { return %s; }", func_name, expression);
+static pid_t rebuild_pid; // 后台编译的子进程 0表示没有
 
-    // 生成临时C文件
-    char c_temp_path[] = "/tmp/crepl_expr_XXXXXX.c";
-    int c_fd = mkstemps(c_temp_path, 2);
-    if (c_fd == -1)
+/**
+ * @brief 用当前的选项重新编译所有定义并换进跳板表
+ * @param void
+ * @return void
+ * @note 源码与 compile_and_load_function 生成的相同 后台编译过的都命中缓存
+ *       编译失败的定义保留旧版本 旧版本的模块不卸载 可能仍有代码在执行它
+ */
+static void rebuild_install(void)
+{
+    int n = def_count;
+    char **srcs = malloc(n * sizeof(char *));
+    void **addrs = malloc(n * sizeof(void *));
+    void **modules = malloc(n * sizeof(void *));
+    for (int i = 0; i < n; i++)
+        srcs[i] = with_prelude(defs[i].src, &defs[i]);
+    if (backend->compile_many != NULL)
     {
-        return false;
+        backend->compile_many(n, srcs, DEF_SYMBOL, addrs, modules);
     }
-    int rc = write(c_fd, function_def, strlen(function_def));
-    if (rc < 0)
+    else
     {
-        return false;
+        for (int i = 0; i < n; i++)
+            addrs[i] = backend->compile(srcs[i], DEF_SYMBOL, NULL, &modules[i]);
     }
 
-    close(c_fd);
-
-    // 生成临时共享库路径
-    char so_temp_path[] = "/tmp/crepl_expr_XXXXXX.so";
-    int so_fd = mkstemps(so_temp_path, 3);
-    close(so_fd);
+    int rebuilt = 0;
+    for (int i = 0; i < n; i++)
+    {
+        free(srcs[i]);
+        if (addrs[i] == NULL)
+        {
+            fprintf(stderr, "crepl: %s: keeping the version built with the old flags\n", defs[i].name);
+            continue;
+        }
+        defs[i].addr = slots[i] = addrs[i];
+        defs[i].module = modules[i];
+        rebuilt++;
+    }
+    if (n > 0)
+        printf("(rebuilt %d of %d functions with the new flags)\n", rebuilt, n);
+    free(srcs);
+    free(addrs);
+    free(modules);
+}
 
-    // 构造编译命令
-    char input[128];
+/**
+ * @brief 开始用新的选项重新编译已有的定义
+ * @param void
+ * @return void
+ * @note 有缓存目录时由子进程编译 结果经缓存目录交给本进程 输入不必等待编译
+ *       其他情况下直接在前台编译 之前未完成的后台编译用的是旧选项 直接结束
+ */
+static void rebuild_start(void)
+{
+    if (rebuild_pid > 0)
+    {
+        kill(rebuild_pid, SIGKILL);
+        waitpid(rebuild_pid, NULL, 0);
+        rebuild_pid = 0;
+    }
+    if (def_count == 0)
+        return;
 
-    snprintf(input, sizeof(input),
-             "gcc -shared -fPIC -o %s %s /tmp/crepl.so -w",
-             so_temp_path, c_temp_path);
+    if (backend->compile == gcc_compile && cache_dir[0] != '\0')
+    {
+        // 子进程退出时不能冲掉继承来的输出缓冲
+        fflush(stdout);
+        fflush(stderr);
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            // 编译错误由前台换入时再报告
+            int null = open("/dev/null", O_WRONLY);
+            if (null != -1)
+                dup2(null, STDERR_FILENO);
+            int n = def_count;
+            char **srcs = malloc(n * sizeof(char *));
+            void **addrs = malloc(n * sizeof(void *));
+            void **modules = malloc(n * sizeof(void *));
+            for (int i = 0; i < n; i++)
+                srcs[i] = with_prelude(defs[i].src, &defs[i]);
+            backend->compile_many(n, srcs, DEF_SYMBOL, addrs, modules);
+            pool_drain();
+            _exit(0);
+        }
+        if (pid > 0)
+        {
+            rebuild_pid = pid;
+            return;
+        }
+    }
+    rebuild_install();
+}
 
-    int status = exe_cmd(input);
+/**
+ * @brief 检查后台编译是否完成 完成时换入新版本
+ * @param wait 是否等待完成
+ * @return void
+ * @note 交互时在处理每行输入前调用 批处理时在 :set 之后立即等待 输出保持确定
+ */
+void rebuild_poll(bool wait)
+{
+    if (rebuild_pid <= 0 || waitpid(rebuild_pid, NULL, wait ? 0 : WNOHANG) == 0)
+        return;
+    rebuild_pid = 0;
+    rebuild_install();
+}
 
-    // 删除临时C文件
-    unlink(c_temp_path);
+/**
+ * @brief 执行 :set 命令
+ * @param args 命令的参数
+ * @return 成功返回true
+ * @note 没有参数时输出当前的选项 选项为空时恢复默认
+ *       新选项先编译一个空单元验证 失败时保留原来的选项
+ */
+static bool set_command(const char *args)
+{
+    while (isspace((unsigned char)*args))
+        args++;
+    if (*args == '\0')
+    {
+        printf("cflags:  %s\n", session_cflags);
+        printf("ldflags: %s\n", session_ldflags);
+        return true;
+    }
 
-    if (status == -1 || WEXITSTATUS(status) != 0)
+    char *target;
+    const char *value;
+    if (strncmp(args, "cflags", 6) == 0 && (args[6] == '\0' || isspace((unsigned char)args[6])))
+        target = session_cflags, value = args + 6;
+    else if (strncmp(args, "ldflags", 7) == 0 && (args[7] == '\0' || isspace((unsigned char)args[7])))
+        target = session_ldflags, value = args + 7;
+    else
     {
-        unlink(so_temp_path);
+        fprintf(stderr, "Usage: :set [cflags|ldflags flags...]\n");
         return false;
     }
+    while (isspace((unsigned char)*value))
+        value++;
+    if (strlen(value) >= SESSION_FLAGS || !crepl_init())
+        return false;
 
-    // 动态加载共享库
-    void *handle = dlopen(so_temp_path, RTLD_LAZY);
-    if (!handle)
+    // 空的追加选项让 gcc 后端临时启动一个进程 不用带着旧选项提前启动的进程
+    char old[SESSION_FLAGS];
+    strcpy(old, target);
+    strcpy(target, value);
+    char probe[] = "char " UNIT_SYMBOL ";";
+    void *module;
+    if (backend->compile(probe, UNIT_SYMBOL, "", &module) == NULL)
     {
-        unlink(so_temp_path);
+        strcpy(target, old);
         return false;
     }
-
-    // 获取函数指针
-    typedef int (*expr_func)();
-    expr_func func = (expr_func)dlsym(handle, func_name);
-    if (!func)
+    backend->release(module);
+    if (backend->configure != NULL && !backend->configure())
     {
-        dlclose(handle);
-        unlink(so_temp_path);
+        strcpy(target, old);
+        backend->configure();
         return false;
     }
+    rebuild_start();
+    return true;
+}
 
-    // 调用函数获取结果
-    *result = func();
+/**
+ * @brief 取编译和缓存的统计
+ * @param void
+ * @return 当前的统计
+ * @note none
+ */
+crepl_stats compile_stats(void)
+{
+    return stats;
+}
 
-    // 清理资源
-    dlclose(handle);
-    unlink(so_temp_path);
-    return true;
+// ======================== 交互 ========================
+
+/**
+ * @brief 输出编译和缓存的统计 :stats
+ * @param void
+ * @return void
+ * @note none
+ */
+static void print_stats(void)
+{
+    unsigned long hits = stats.mem_hits + stats.disk_hits;
+    unsigned long lookups = hits + stats.misses;
+    printf("backend:        %s\n", backend ? backend->name : "(none yet)");
+    printf("fast path:      %lu expressions\n", stats.fast);
+    printf("compiles:       %lu, %.1f ms total, %.1f ms each\n", stats.misses,
+           stats.compile_time * 1e3, stats.misses ? stats.compile_time * 1e3 / stats.misses : 0);
+    printf("cache hits:     %lu in session, %lu from disk (%.0f%% hit rate)\n", stats.mem_hits,
+           stats.disk_hits, lookups ? hits * 100.0 / lookups : 0);
+    printf("time saved:     %.1f ms (estimated)\n", stats.saved_time * 1e3);
 }
 
-int main()
+/**
+ * @brief 执行以 ':' 开头的命令
+ * @param cmd 命令 不含 ':'
+ * @return 命令存在返回true
+ * @note none
+ */
+bool run_command(const char *cmd)
 {
+    if (strcmp(cmd, "stats") == 0)
+    {
+        print_stats();
+        return true;
+    }
+    if (strncmp(cmd, "bench", 5) == 0 && (cmd[5] == '\0' || isspace((unsigned char)cmd[5])))
+    {
+        return bench_command(cmd + 5);
+    }
+    if (strncmp(cmd, "set", 3) == 0 && (cmd[3] == '\0' || isspace((unsigned char)cmd[3])))
+    {
+        return set_command(cmd + 3);
+    }
+    return false;
+}
+
+/**
+ * @brief 处理交互输入的一行
+ * @param line 输入
+ * @return void
+ * @note 实际运行了编译器时报告这一行的编译耗时
+ */
+static void process_line(const char *line)
+{
+    rebuild_poll(false);
+    bool flag = false;
+    unsigned long misses = stats.misses;
+    double compile_time = stats.compile_time;
+    char name[MAX_NAME];
+    if (line[0] == ':')
+    {
+        flag = run_command(line + 1);
+    }
+    else if (is_declaration(line))
+    {
+        flag = declare(line);
+    }
+    else if (is_definition(line, name))
+    {
+        flag = compile_and_load_function(line);
+    }
+    else
+    {
+        crepl_value value;
+        if (evaluate_value(line, &value))
+        {
+            flag = true;
+            print_value(&value);
+        }
+    }
+    if (!flag)
+    {
+        printf("error\n");
+    }
+    if (stats.misses != misses)
+    {
+        printf("(compiled in %.1f ms)\n", (stats.compile_time - compile_time) * 1e3);
+    }
+}
 
-    // 初始化汇总文件
-    FILE *summary_file = fopen("/tmp/crepl_summary.c", "w");
-    if (summary_file)
+int main(int argc, char *argv[])
+{
+    // -f 指定脚本 标准输入不是终端时也按批处理执行
+    const char *script = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:")) != -1)
+    {
+        if (opt != 'f')
+        {
+            fprintf(stderr, "Usage: %s [-f script]\n", argv[0]);
+            return 1;
+        }
+        script = optarg;
+    }
+    if (script != NULL && strcmp(script, "-") != 0)
+    {
+        FILE *fp = fopen(script, "r");
+        if (fp == NULL)
+        {
+            fprintf(stderr, "crepl: %s: %s\n", script, strerror(errno));
+            return 1;
+        }
+        int status = run_script(fp);
+        fclose(fp);
+        return status;
+    }
+    if (script != NULL || !isatty(STDIN_FILENO))
     {
-        fclose(summary_file);
+        return run_script(stdin);
     }
-    char inputf[128];
-    strcpy(inputf, "gcc -shared -fPIC -o /tmp/crepl.so /tmp/crepl_summary.c -w");
-    exe_cmd(inputf);
 
     char *line = NULL;
 
@@ -231,30 +2797,9 @@ int main()
         add_history(line);
 
         // 处理输入
-        bool flag = false;
-        if (compile_and_load_function(line))
-        {
-            flag = true;
-        }
-        else
-        {
-            int result = 0;
-            if (evaluate_expression(line, &result))
-            {
-                flag = true;
-                printf("Result: %d\n", result);
-            }
-        }
-        if (!flag)
-        {
-            printf("error\n");
-        }
+        process_line(line);
         free(line); // 释放 readline 分配的内存
     }
 
-    // 删除汇总文件和共享库
-    unlink("/tmp/crepl_summary.c");
-    unlink("/tmp/crepl.so");
-
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,118 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MAX_DEFS 4096      // 会话中最多的函数定义数
+#define MAX_NAME 64        // 函数名的最大长度
+#define CACHE_ENTRIES 1024 // 会话内编译缓存的项数
+#define CACHE_MAX_MB 256   // 缓存目录的大小上限 启动时删掉最久没用的
+#define POOL_SIZE 2        // 提前启动 等待源码的 gcc 进程数
+#define GCC_MAX_ARGS 64    // gcc 命令的最大参数数
+#define BATCH_JOBS 64      // 批处理时同时运行的 gcc 进程数上限
+#define UNIT_PARTS 64      // 批处理时每个编译单元最多合并的定义或表达式数
+#define VALUE_BYTES 16     // 表达式结果保存的最大字节数 结构体超出的部分截断
+#define STRING_PREVIEW 80  // 输出字符串结果时的最大字符数
+#define SESSION_FLAGS 512  // :set 设置的编译或链接选项的最大长度
+
+#define BENCH_LEVELS "-O0 -O2 -O3"  // :bench 默认比较的优化级别
+#define BENCH_FLAGS "-march=native" // :bench 每个级别都加上的选项
+#define BENCH_MAX_LEVELS 8          // :bench 一次最多比较的级别数
+#define BENCH_SAMPLES 10            // :bench 每个级别的样本数
+#define BENCH_SAMPLE_NS 10000000.0  // 自动确定迭代次数时每个样本至少的耗时
+#define BENCH_NOISE_NS 0.2          // 扣除空循环后低于此值视为表达式被优化掉
+
+#define SLOTS_SYMBOL "__crepl_slots" // 跳板表
+#define DEF_SYMBOL "__crepl_self"    // 定义编译出的函数
+#define EXPR_SYMBOL "__crepl_expr"   // 表达式的包装函数
+#define UNIT_SYMBOL "__crepl_unit"   // 批处理时每个编译单元的标记
+#define BENCH_SYMBOL "__crepl_bench" // :bench 的计时循环 空循环为 BENCH_SYMBOL "_empty"
+
+// 一个已定义的函数
+// 其他代码经跳板表中的槽间接调用它 重新定义时只需更新槽
+typedef struct
+{
+    char name[MAX_NAME];
+    char *src;    // 定义的源码
+    char *type;   // 函数指针类型 如 "int (*)(int x)"
+    int int_arity; // 返回值和参数都是 int 时的参数个数 否则为-1 快速路径只调用这类函数
+    void *addr;   // 当前版本的地址 同时写入跳板表
+    void *module; // 后端的模块句柄
+} definition;
+
+// 快速路径的求值结果
+typedef enum
+{
+    FAST_OK,          // 已求值
+    FAST_UNSUPPORTED, // 超出解释器支持的范围 交给编译器
+    FAST_ERROR,       // 运行时错误 如除以0
+} fast_status;
+
+#define FAST_MAX_ARGS 6 // 快速路径调用函数时的最大参数数
+
+// 表达式结果的类型 由包装函数中的 _Generic 判断
+typedef enum
+{
+    VALUE_VOID,    // 没有值 如调用 void 函数
+    VALUE_INT,     // 有符号整数 按 size 区分宽度
+    VALUE_UINT,    // 无符号整数
+    VALUE_BOOL,    // _Bool
+    VALUE_CHAR,    // char
+    VALUE_FLOAT,   // 浮点数 按 size 区分 float、double、long double
+    VALUE_STRING,  // char * 输出指向的字符串
+    VALUE_POINTER, // 其他指针
+    VALUE_OBJECT,  // 结构体、联合等 输出大小和开头的字节
+} value_kind;
+
+// 表达式的结果
+typedef struct
+{
+    value_kind kind;
+    size_t size;                      // 值的字节数
+    unsigned char bytes[VALUE_BYTES]; // 值的前 VALUE_BYTES 个字节
+} crepl_value;
+
+// :bench 一个优化级别的测量结果 单位 ns/op 已扣除空循环的开销
+typedef struct
+{
+    double mean;
+    double stddev;
+    double min;
+    long iterations; // 每个样本的迭代次数
+} bench_result;
+
+// 编译和缓存的统计
+typedef struct
+{
+    unsigned long fast;      // 快速路径求值的次数
+    unsigned long misses;    // 实际运行编译器的次数
+    unsigned long mem_hits;  // 会话内缓存命中
+    unsigned long disk_hits; // 缓存目录命中
+    double compile_time;     // 编译器的总耗时 秒
+    double saved_time;       // 命中省下的时间 按平均编译耗时估计
+} crepl_stats;
+
+// 编译后端
+// configure 会话的编译或链接选项改变后调用 为NULL时 compile 每次直接读取选项
+// compile 编译一段源码并返回其中 symbol 的地址 module 交给 release 释放
+//         flags 是追加在会话选项之后的编译选项 以空白分隔 NULL表示没有
+// compile_many 同时编译一组源码 失败的项地址为NULL 为NULL时逐个调用 compile
+// lookup 取模块中的其他符号
+typedef struct
+{
+    const char *name;
+    bool (*init)(void);
+    bool (*configure)(void);
+    void *(*compile)(const char *src, const char *symbol, const char *flags, void **module);
+    void (*compile_many)(int n, char **srcs, const char *symbol, void **addrs, void **modules);
+    void *(*lookup)(void *module, const char *symbol);
+    void (*release)(void *module);
+} compile_backend;
+
+bool compile_and_load_function(const char *function_def);
+bool evaluate_expression(const char *expression, int *result);
+bool evaluate_value(const char *expression, crepl_value *value);
+fast_status fast_evaluate(const char *expression, int *result);
+crepl_stats compile_stats(void);
+void cache_prune(const char *dir, long long max_bytes);
+long bench_iterations(char *expression);
+bool run_command(const char *cmd);
+void rebuild_poll(bool wait);
@@ -3,11 +3,40 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "crepl.h"
 
 // Feel free to rename them.
 bool compile_and_load_function(const char *function_def);
 bool evaluate_expression(const char *expression, int *result);
 
+// Keep the compile cache of test runs out of ~/.cache. This runs before
+// TestKit forks its worker, so every test case inherits the directory;
+// the original process removes it after the worker is done.
+static char test_cache[] = "/tmp/crepl-test-XXXXXX";
+
+static void remove_test_cache(void)
+{
+    if (getpid() != (pid_t)atol(getenv("CREPL_TEST_OWNER")))
+        return;
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", test_cache);
+    system(cmd);
+}
+
+__attribute__((constructor(101))) static void use_test_cache(void)
+{
+    if ((!getenv("TK_RUN") && !getenv("TK_VERBOSE")) || mkdtemp(test_cache) == NULL)
+        return;
+    char owner[16];
+    snprintf(owner, sizeof(owner), "%d", (int)getpid());
+    setenv("CREPL_CACHE", test_cache, 1);
+    setenv("CREPL_TEST_OWNER", owner, 1);
+    atexit(remove_test_cache);
+}
+
 UnitTest(test_compile_valid_function)
 {
     bool result = compile_and_load_function("int test_func() { return 42; }");
@@ -77,3 +106,157 @@ UnitTest(test_evaluate_syntax_error)
     bool result = evaluate_expression("21 +", &result_value);
     tk_assert(result == false, "Should fail on syntax error");
 }
+
+UnitTest(test_redefine_function)
+{
+    compile_and_load_function("int test_base() { return 1; }");
+    compile_and_load_function("int test_caller() { return test_base() * 10; }");
+
+    bool result = compile_and_load_function("int test_base() { return 2; }");
+    tk_assert(result == true, "Should successfully redefine a function");
+
+    int result_value;
+    evaluate_expression("test_caller()", &result_value);
+    tk_assert(result_value == 20, "Earlier callers should see the new definition");
+}
+
+UnitTest(test_evaluate_division_by_zero)
+{
+    int result_value;
+    bool result = evaluate_expression("1 / 0", &result_value);
+    tk_assert(result == false, "Should fail on division by zero");
+
+    result = evaluate_expression("0 && 1 / 0", &result_value);
+    tk_assert(result == true, "Should not evaluate the short-circuited operand");
+    tk_assert(result_value == 0, "Result should be 0");
+}
+
+UnitTest(test_compile_non_int_function)
+{
+    bool result = compile_and_load_function("double test_half(double x) { return x / 2; }");
+    tk_assert(result == true, "Should compile a function returning double");
+
+    int result_value;
+    result = evaluate_expression("test_half(9) * 2", &result_value);
+    tk_assert(result == true, "Should evaluate a double expression");
+    tk_assert(result_value == 9, "Result should be converted to 9");
+
+    result = evaluate_expression("\"not a number\"", &result_value);
+    tk_assert(result == false, "A string has no int value");
+}
+
+UnitTest(test_fast_path_increment_operators)
+{
+    int result_value;
+    tk_assert(fast_evaluate("5--3", &result_value) == FAST_UNSUPPORTED,
+              "-- is not a binary operator; leave it to the compiler");
+    tk_assert(fast_evaluate("5++3", &result_value) == FAST_UNSUPPORTED,
+              "++ is not a binary operator; leave it to the compiler");
+    tk_assert(evaluate_expression("5--3", &result_value) == false, "5--3 should not compile");
+
+    tk_assert(fast_evaluate("5 - -3", &result_value) == FAST_OK && result_value == 8,
+              "5 - -3 should be 8 on the fast path");
+    tk_assert(fast_evaluate("5-+3", &result_value) == FAST_OK && result_value == 2,
+              "5-+3 should be 2 on the fast path");
+}
+
+UnitTest(test_repeated_expression_hits_cache)
+{
+    crepl_value value;
+    unsigned long misses = compile_stats().misses;
+    bool result = evaluate_value("(long)sizeof(int[7])", &value);
+    tk_assert(result == true, "Should evaluate a sizeof expression");
+    tk_assert(compile_stats().misses == misses + 1, "The first evaluation should compile");
+
+    result = evaluate_value("(long)sizeof(int[7])", &value);
+    tk_assert(result == true, "Should evaluate the expression again");
+    tk_assert(compile_stats().misses == misses + 1, "The second evaluation should not compile");
+    tk_assert(compile_stats().mem_hits >= 1, "The second evaluation should hit the session cache");
+}
+
+UnitTest(test_cache_prune_oldest)
+{
+    char dir[] = "/tmp/crepl-prune-XXXXXX";
+    tk_assert(mkdtemp(dir) != NULL, "mkdtemp should succeed");
+
+    // Four 1 KiB libraries, a.so the oldest; other files are not ours
+    const char *names[] = {"a.so", "b.so", "c.so", "d.so", "notes.txt"};
+    char path[128], data[1024] = {0};
+    for (int i = 0; i < 5; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        FILE *fp = fopen(path, "w");
+        fwrite(data, 1, sizeof(data), fp);
+        fclose(fp);
+        struct timespec times[2] = {{.tv_sec = 1000 + i}, {.tv_sec = 1000 + i}};
+        utimensat(AT_FDCWD, path, times, 0);
+    }
+
+    cache_prune(dir, 2500);
+    bool kept[5];
+    for (int i = 0; i < 5; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        kept[i] = access(path, F_OK) == 0;
+        unlink(path);
+    }
+    rmdir(dir);
+    tk_assert(!kept[0] && !kept[1], "The two oldest libraries should be removed");
+    tk_assert(kept[2] && kept[3], "The newest libraries should be kept");
+    tk_assert(kept[4], "Files the cache did not write should be left alone");
+}
+
+UnitTest(test_bench_iterations)
+{
+    static const struct
+    {
+        const char *args, *expression;
+        long iterations;
+    } cases[] = {
+        {"f(1) 100", "f(1)", 100},
+        {"f(1)   100  ", "f(1)", 100},
+        {"x - 100", "x - 100", 0},
+        {"x -100", "x -100", 0},
+        {"g(1, 100)", "g(1, 100)", 0},
+        {"f(2)", "f(2)", 0},
+        {"100", "100", 0},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        char expression[64];
+        strcpy(expression, cases[i].args);
+        long iterations = bench_iterations(expression);
+        tk_assert(iterations == cases[i].iterations && strcmp(expression, cases[i].expression) == 0,
+                  "\"%s\": expected \"%s\" x %ld, got \"%s\" x %ld", cases[i].args,
+                  cases[i].expression, cases[i].iterations, expression, iterations);
+    }
+}
+
+UnitTest(test_set_cflags_rebuilds)
+{
+    compile_and_load_function("int test_k() {\n#ifdef K\nreturn K;\n#else\nreturn 1;\n#endif\n}");
+    compile_and_load_function("int test_k_caller() { return test_k() * 10; }");
+    int result_value;
+    evaluate_expression("test_k_caller()", &result_value);
+    tk_assert(result_value == 10, "Without -DK the caller should get 10");
+
+    bool result = run_command("set cflags -DK=2");
+    tk_assert(result == true, "Should accept -DK=2");
+    rebuild_poll(true);
+    result = evaluate_expression("K + test_k_caller()", &result_value);
+    tk_assert(result == true, "Expressions should see the new flags");
+    tk_assert(result_value == 22, "Existing callers should see the rebuilt test_k, got %d", result_value);
+
+    result = run_command("set cflags -fno-such-flag");
+    tk_assert(result == false, "Should reject an invalid flag");
+    rebuild_poll(true);
+    result = evaluate_expression("K * test_k()", &result_value);
+    tk_assert(result == true && result_value == 4, "The old flags should be kept");
+}
+
+SystemTest(missing_script, ((const char *[]){"-f", "/nonexistent/script.crepl"}))
+{
+    tk_assert(result->exit_status == 1, "Missing script should exit with status 1");
+    tk_assert(strstr(result->output, "script.crepl") != NULL,
+              "Output should name the missing script");
+}
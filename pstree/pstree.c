@@ -7,142 +7,685 @@
 #include <getopt.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
 #include "pstree.h"
 
-HashNode hashTable[HASH_SIZE];
+// 扫描 /proc 得到的所有进程 每个进程只读一次
+ProcInfo *procs;
+int proc_count;
+PidMap pidMap;
 
-Node *createNode(int pid)
+// 读取的目录 测试时可以指向模拟 /proc 的目录树
+const char *procRoot = "/proc";
+// 读取线程数 0表示按 CPU 数自动确定
+int threadCount;
+// 是否尝试用 io_uring 批量读取 不可用时自动退回逐个读取
+// 路径查找会交给 io-wq 线程 核少时反而比逐个读取慢 所以默认不用
+bool useUring = false;
+// 是否在每个节点后标注自身和子树的 CPU 时间与常驻内存
+bool showUsage;
+// 子树的 CPU 时间（秒）或常驻内存（MB）低于阈值时不输出 0表示不限制
+double minCpu;
+double minRss;
+// 按用量排序时比较的子树用量 qsort 的比较函数没有上下文参数
+const Usage *sortTotals;
+
+// 乘法哈希 相邻的 PID 分散到不同的槽
+int hashFunction(int key, int mask)
+{
+  return (int)((unsigned)key * 2654435761u >> 7) & mask;
+}
+
+void pidMapInit(PidMap *map, int count)
 {
-  Node *node = (Node *)malloc(sizeof(Node));
-  node->pid = pid;
-  node->child_count = 0;
-  for (int i = 0; i < MAX_NODES; i++)
+  int capacity = 16;
+  while (capacity < 2 * count)
   {
-    node->children[i] = NULL;
+    capacity *= 2;
   }
-  return node;
+  map->keys = calloc(capacity, sizeof(int));
+  map->values = malloc(capacity * sizeof(int));
+  map->mask = capacity - 1;
 }
 
-int hashFunction(int key)
+// 插入或更新 容量由 pidMapInit 保证足够
+void pidMapPut(PidMap *map, int pid, int value)
 {
-  return key % HASH_SIZE;
+  int i = hashFunction(pid, map->mask);
+  while (map->keys[i] != 0 && map->keys[i] != pid)
+  {
+    i = (i + 1) & map->mask;
+  }
+  map->keys[i] = pid;
+  map->values[i] = value;
 }
 
-void insertHash(int pid, int ppid)
+// 查找 不存在时返回-1
+int pidMapGet(const PidMap *map, int pid)
 {
-  int index = hashFunction(pid);
-  hashTable[index].pid = pid;
-  hashTable[index].ppid = ppid;
+  if (map->keys == NULL || pid == 0)
+  {
+    return -1;
+  }
+  for (int i = hashFunction(pid, map->mask); map->keys[i] != 0; i = (i + 1) & map->mask)
+  {
+    if (map->keys[i] == pid)
+    {
+      return map->values[i];
+    }
+  }
+  return -1;
 }
 
-// 添加子节点
-void addChild(Node *parent, Node *child)
+void pidMapFree(PidMap *map)
 {
-  parent->children[parent->child_count++] = child;
+  free(map->keys);
+  free(map->values);
+  map->keys = map->values = NULL;
 }
 
-// 查找节点
-Node *findNode(Node *nodes[], int pid, int node_count)
+// 一遍建树 孩子列表按 ppid 计数排序 父进程不在 /proc 中的进程是根 如 init(1) 和 kthreadd(2)
+void buildTree(Tree *tree)
 {
-  for (int i = 0; i < node_count; i++)
+  int *parent = malloc(proc_count * sizeof(int));
+  tree->nodes = calloc(proc_count, sizeof(Node));
+  tree->children = malloc(proc_count * sizeof(int));
+  tree->roots = malloc(proc_count * sizeof(int));
+  tree->root_count = 0;
+
+  // 数出每个节点的孩子数 前缀和得到各段的起点
+  for (int i = 0; i < proc_count; i++)
   {
-    if (nodes[i]->pid == pid)
+    parent[i] = pidMapGet(&pidMap, procs[i].ppid);
+    if (parent[i] == i)
+    {
+      parent[i] = -1;
+    }
+    if (parent[i] >= 0)
+    {
+      tree->nodes[parent[i]].child_count++;
+    }
+    else
     {
-      return nodes[i];
+      tree->roots[tree->root_count++] = i;
     }
   }
-  return NULL;
+  int offset = 0;
+  for (int i = 0; i < proc_count; i++)
+  {
+    tree->nodes[i].first_child = offset;
+    offset += tree->nodes[i].child_count;
+    tree->nodes[i].child_count = 0;
+  }
+  for (int i = 0; i < proc_count; i++)
+  {
+    if (parent[i] >= 0)
+    {
+      Node *node = &tree->nodes[parent[i]];
+      tree->children[node->first_child + node->child_count++] = i;
+    }
+  }
+  free(parent);
+  sumUsage(tree);
 }
 
-// 比较函数，用于 qsort
+// 累加每棵子树的用量 用量取自扫描时的记录 不再读文件
+// order 按层序排列所有节点 倒过来处理时孩子总在父节点之前 相当于后序遍历
+void sumUsage(Tree *tree)
+{
+  int *order = malloc((proc_count + 1) * sizeof(int));
+  tree->total = calloc(proc_count + 1, sizeof(Usage));
+  int n = 0;
+  for (int i = 0; i < tree->root_count; i++)
+  {
+    order[n++] = tree->roots[i];
+  }
+  for (int k = 0; k < n; k++)
+  {
+    const Node *node = &tree->nodes[order[k]];
+    memcpy(order + n, tree->children + node->first_child, node->child_count * sizeof(int));
+    n += node->child_count;
+  }
+  for (int k = n - 1; k >= 0; k--)
+  {
+    int i = order[k];
+    const Node *node = &tree->nodes[i];
+    Usage *total = &tree->total[i];
+    total->cpu = procs[i].cpu;
+    total->rss = procs[i].rss;
+    for (int c = 0; c < node->child_count; c++)
+    {
+      const Usage *child = &tree->total[tree->children[node->first_child + c]];
+      total->cpu += child->cpu;
+      total->rss += child->rss;
+    }
+  }
+  free(order);
+}
+
+void freeTree(Tree *tree)
+{
+  free(tree->nodes);
+  free(tree->children);
+  free(tree->roots);
+  free(tree->total);
+}
+
+// 比较函数，用于 qsort 按 procs 下标比较 PID
 int compareNodes(const void *a, const void *b)
 {
-  Node *node_a = *(Node **)a;
-  Node *node_b = *(Node **)b;
-  return node_a->pid - node_b->pid;
+  return procs[*(const int *)a].pid - procs[*(const int *)b].pid;
+}
+
+// 子树用量大的在前 相同时按 PID
+int compareCpu(const void *a, const void *b)
+{
+  unsigned long long x = sortTotals[*(const int *)a].cpu, y = sortTotals[*(const int *)b].cpu;
+  return x != y ? (x < y ? 1 : -1) : compareNodes(a, b);
+}
+
+int compareRss(const void *a, const void *b)
+{
+  long x = sortTotals[*(const int *)a].rss, y = sortTotals[*(const int *)b].rss;
+  return x != y ? (x < y ? 1 : -1) : compareNodes(a, b);
+}
+
+void sortNodes(const Tree *tree, int *nodes, int count, int sort)
+{
+  sortTotals = tree->total;
+  if (sort == SORT_PID)
+  {
+    qsort(nodes, count, sizeof(int), compareNodes);
+  }
+  else if (sort == SORT_CPU)
+  {
+    qsort(nodes, count, sizeof(int), compareCpu);
+  }
+  else if (sort == SORT_RSS)
+  {
+    qsort(nodes, count, sizeof(int), compareRss);
+  }
+}
+
+// 子树的用量是否达到 --min-cpu、--min-rss 的阈值
+// 父节点的用量不小于任何一个孩子 剪掉一个节点时它的整棵子树都在阈值以下
+bool keepNode(const Tree *tree, int node)
+{
+  static double tick, page;
+  if (tick == 0)
+  {
+    tick = sysconf(_SC_CLK_TCK);
+    page = sysconf(_SC_PAGESIZE);
+  }
+  const Usage *total = &tree->total[node];
+  return total->cpu >= minCpu * tick && total->rss * page >= minRss * 1024 * 1024;
 }
 
-// 递归打印树
-void printTree(Node *node, int depth, int is_last_child, int show_pid, int sort)
+// 把要输出的节点移到前面并保持原有顺序 返回它们的个数
+int filterNodes(const Tree *tree, int *nodes, int count)
 {
-  //
-  for (int i = 0; i < depth - 1; i++)
+  if (minCpu <= 0 && minRss <= 0)
   {
-    printf("  ");
+    return count;
   }
-  if (depth > 0)
+  int kept = 0;
+  for (int i = 0; i < count; i++)
   {
-    if (is_last_child)
+    if (keepNode(tree, nodes[i]))
     {
-      printf("└─");
+      int node = nodes[i];
+      nodes[i] = nodes[kept];
+      nodes[kept++] = node;
     }
-    else
+  }
+  return kept;
+}
+
+// ======================== 输出 ========================
+
+// 整棵树先写进一块缓冲区 最后一次 write 写出 不经过 stdio 的逐段格式化
+// 每行的前缀由祖先决定 不是最后一个孩子的祖先留下 "│ " 其余留下两个空格
+// 前缀按深度压栈 兄弟节点共用父节点的前缀 每行只需复制一次
+
+void bufferAppend(OutBuf *out, const char *data, size_t len)
+{
+  if (out->len + len > out->cap)
+  {
+    size_t cap = out->cap ? out->cap : OUTPUT_INITIAL;
+    while (cap < out->len + len)
     {
-      printf("├─");
+      cap *= 2;
     }
+    out->data = realloc(out->data, cap);
+    out->cap = cap;
   }
+  memcpy(out->data + out->len, data, len);
+  out->len += len;
+}
 
-  char *name = getName(node->pid);
-  if (name != NULL)
+// 追加十进制整数
+void appendInt(OutBuf *out, long value)
+{
+  char digits[24];
+  int i = sizeof(digits);
+  bool negative = value < 0;
+  unsigned long v = negative ? -(unsigned long)value : (unsigned long)value;
+  do
+  {
+    digits[--i] = '0' + v % 10;
+    v /= 10;
+  } while (v != 0);
+  if (negative)
   {
-    printf("%s", name);
+    digits[--i] = '-';
   }
+  bufferAppend(out, digits + i, sizeof(digits) - i);
+}
+
+// 节点本身的内容 进程名和进程号 不含前缀和换行
+void appendLabel(OutBuf *out, int node, int show_pid)
+{
+  bufferAppend(out, procs[node].name, strlen(procs[node].name));
   if (show_pid)
   {
-    printf("(%d)", node->pid);
+    bufferAppend(out, "(", 1);
+    appendInt(out, procs[node].pid);
+    bufferAppend(out, ")", 1);
+  }
+}
+
+// 以 K、M、G 为单位的大小 保留一位小数
+void formatSize(char *text, size_t size, double bytes)
+{
+  static const char units[] = "KMGT";
+  double value = bytes / 1024;
+  int i = 0;
+  while (value >= 1024 && units[i + 1] != '\0')
+  {
+    value /= 1024;
+    i++;
   }
+  snprintf(text, size, "%.1f%c", value, units[i]);
+}
+
+// 节点自身和子树的 CPU 时间与常驻内存 如 " [cpu 0.52s/12.40s rss 3.1M/250.0M]"
+void appendUsage(OutBuf *out, const Tree *tree, int node)
+{
+  static double tick, page;
+  if (tick == 0)
+  {
+    tick = sysconf(_SC_CLK_TCK);
+    page = sysconf(_SC_PAGESIZE);
+  }
+  const Usage *total = &tree->total[node];
+  char own_rss[16], total_rss[16], text[96];
+  formatSize(own_rss, sizeof(own_rss), procs[node].rss * page);
+  formatSize(total_rss, sizeof(total_rss), total->rss * page);
+  int len = snprintf(text, sizeof(text), " [cpu %.2fs/%.2fs rss %s/%s]", procs[node].cpu / tick,
+                     total->cpu / tick, own_rss, total_rss);
+  bufferAppend(out, text, len);
+}
+
+// 把以 root 为根的子树写进缓冲区 根在第0列 用显式栈代替递归 很深的链也不会栈溢出
+void renderTree(OutBuf *out, const Tree *tree, int root, int show_pid, int sort)
+{
+  static const char branch[] = "├─", last_branch[] = "└─";
+  static const char pipe[] = "│ ", blank[] = "  ";
+
+  int depth_cap = 64;
+  int *stack = malloc(depth_cap * sizeof(int));   // 每层的节点
+  int *next = malloc(depth_cap * sizeof(int));    // 每层下一个要输出的孩子
+  int *shown = malloc(depth_cap * sizeof(int));   // 每层剪枝后要输出的孩子数
+  size_t *prefix_len = malloc(depth_cap * sizeof(size_t)); // 每层孩子的前缀长度
+  size_t prefix_cap = 256;
+  char *prefix = malloc(prefix_cap);
 
-  // 处理重复进程
-  int count = 0;
-  for (int i = 0; i < node->child_count; i++)
+  appendLabel(out, root, show_pid);
+  if (showUsage)
   {
-    if (node->children[i]->pid == node->pid)
+    appendUsage(out, tree, root);
+  }
+  bufferAppend(out, "\n", 1);
+  stack[0] = root;
+  next[0] = 0;
+  prefix_len[0] = 0;
+  int depth = 0;
+  while (depth >= 0)
+  {
+    const Node *node = &tree->nodes[stack[depth]];
+    int *children = tree->children + node->first_child;
+    if (next[depth] == 0)
+    {
+      shown[depth] = filterNodes(tree, children, node->child_count);
+      sortNodes(tree, children, shown[depth], sort);
+    }
+    if (next[depth] == shown[depth])
+    {
+      depth--;
+      continue;
+    }
+
+    int child = children[next[depth]++];
+    bool is_last = next[depth] == shown[depth];
+    bufferAppend(out, prefix, prefix_len[depth]);
+    bufferAppend(out, is_last ? last_branch : branch, sizeof(branch) - 1);
+    appendLabel(out, child, show_pid);
+    if (showUsage)
+    {
+      appendUsage(out, tree, child);
+    }
+    bufferAppend(out, "\n", 1);
+    if (tree->nodes[child].child_count == 0)
+    {
+      continue;
+    }
+
+    // 孩子的孩子的前缀 = 当前前缀 + 孩子留下的一段
+    if (depth + 1 == depth_cap)
     {
-      count++;
+      depth_cap *= 2;
+      stack = realloc(stack, depth_cap * sizeof(int));
+      next = realloc(next, depth_cap * sizeof(int));
+      shown = realloc(shown, depth_cap * sizeof(int));
+      prefix_len = realloc(prefix_len, depth_cap * sizeof(size_t));
     }
+    const char *segment = is_last ? blank : pipe;
+    size_t segment_len = strlen(segment);
+    if (prefix_len[depth] + segment_len > prefix_cap)
+    {
+      prefix_cap *= 2;
+      prefix = realloc(prefix, prefix_cap);
+    }
+    memcpy(prefix + prefix_len[depth], segment, segment_len);
+    depth++;
+    stack[depth] = child;
+    next[depth] = 0;
+    prefix_len[depth] = prefix_len[depth - 1] + segment_len;
+  }
+  free(stack);
+  free(next);
+  free(shown);
+  free(prefix_len);
+  free(prefix);
+}
+
+// 写出缓冲区并清空
+// 标准输出是文件时直接 write 被替换成内存流时（如测试中）经 fwrite 写入
+void flushOutput(OutBuf *out)
+{
+  int fd = fileno(stdout);
+  if (fd < 0)
+  {
+    fwrite(out->data, 1, out->len, stdout);
+    out->len = 0;
+    return;
+  }
+  fflush(stdout);
+  for (size_t done = 0; done < out->len;)
+  {
+    ssize_t n = write(fd, out->data + done, out->len - done);
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      perror("write");
+      break;
+    }
+    done += n;
+  }
+  out->len = 0;
+}
+
+// 打印所有的树
+void printTree(const Tree *tree, int show_pid, int sort)
+{
+  int root_count = filterNodes(tree, tree->roots, tree->root_count);
+  sortNodes(tree, tree->roots, root_count, sort);
+  OutBuf out = {0};
+  for (int i = 0; i < root_count; i++)
+  {
+    renderTree(&out, tree, tree->roots[i], show_pid, sort);
+  }
+  flushOutput(&out);
+  free(out.data);
+}
+
+// ======================== 监视 ========================
+
+// --watch 每隔一段时间重新列出目录 与上一次的进程号比较
+// 只读取新出现的进程 和父进程退出后被重新收养的进程 读文件的次数与变化的进程数成正比
+// 只输出新出现和已退出的子树 标出它们的父进程 未变化的部分不再重复
+
+// 交换全局的进程表与 s
+void swapSnapshot(Snapshot *s)
+{
+  Snapshot current = {procs, proc_count, pidMap};
+  procs = s->procs;
+  proc_count = s->count;
+  pidMap = s->map;
+  *s = current;
+}
+
+// 一段变化的子树 第一行是父进程 之后是子树本身
+void appendChange(OutBuf *out, const Tree *tree, int node, char sign, int show_pid, int sort,
+                  const char *color)
+{
+  if (!keepNode(tree, node))
+  {
+    return;
   }
-  if (count > 0)
+  int parent = pidMapGet(&pidMap, procs[node].ppid);
+  bufferAppend(out, &sign, 1);
+  bufferAppend(out, " ", 1);
+  if (parent >= 0)
   {
-    printf("─%d*[Process]", count + 1);
-    if (show_pid)
+    appendLabel(out, parent, 1);
+  }
+  else
+  {
+    bufferAppend(out, "(no parent)", 11);
+  }
+  bufferAppend(out, ":\n", 2);
+  if (color != NULL)
+  {
+    bufferAppend(out, color, strlen(color));
+  }
+  renderTree(out, tree, node, show_pid, sort);
+  if (color != NULL)
+  {
+    bufferAppend(out, "\033[0m", 4);
+  }
+}
+
+// 刷新一次 把变化写进 out 更新全局的进程表和 tree 返回新出现和退出的进程数
+int watchStep(Tree *tree, OutBuf *out, int show_pid, int sort, bool color)
+{
+  int *pids;
+  int count = listPids(&pids);
+
+  // seen: 0 已退出 1 仍在 2 仍在但要重新读取
+  char *seen = calloc(proc_count + 1, 1);
+  int *reread = malloc((count + proc_count + 1) * sizeof(int));
+  int fresh = 0;
+  for (int i = 0; i < count; i++)
+  {
+    int index = pidMapGet(&pidMap, pids[i]);
+    if (index >= 0)
     {
-      printf("(%d)", node->pid);
+      seen[index] = 1;
     }
-    for (int i = 0; i < node->child_count; i++)
+    else
     {
-      if (node->children[i]->pid != node->pid)
+      reread[fresh++] = pids[i];
+    }
+  }
+  free(pids);
+  int exited = 0;
+  for (int i = 0; i < proc_count; i++)
+  {
+    exited += seen[i] == 0;
+  }
+  if (fresh == 0 && exited == 0)
+  {
+    free(seen);
+    free(reread);
+    return 0;
+  }
+
+  // 父进程退出的进程被 init 或 subreaper 收养 父进程号变了
+  int nreread = fresh;
+  for (int i = 0; i < proc_count; i++)
+  {
+    const Node *node = &tree->nodes[i];
+    for (int k = 0; seen[i] == 0 && k < node->child_count; k++)
+    {
+      int child = tree->children[node->first_child + k];
+      if (seen[child] == 1)
       {
-        printf("\n");
-        printTree(node->children[i], depth + 1, i == node->child_count - 1, show_pid, sort);
+        seen[child] = 2;
+        reread[nreread++] = procs[child].pid;
       }
     }
   }
-  else
+  ProcInfo *read = malloc((nreread + 1) * sizeof(ProcInfo));
+  int got = scanPids(reread, nreread, read);
+  free(reread);
+
+  // 新的进程表 = 未变的记录 + 新读到的记录
+  ProcInfo *next = malloc((proc_count + got + 1) * sizeof(ProcInfo));
+  int n = 0;
+  for (int i = 0; i < proc_count; i++)
   {
-    // Test
-    if (sort)
+    if (seen[i] == 1)
     {
-      qsort(node->children, node->child_count, sizeof(Node *), compareNodes);
+      next[n++] = procs[i];
     }
-    for (int i = 0; i < node->child_count; i++)
+  }
+  int first_read = n;
+  memcpy(next + n, read, got * sizeof(ProcInfo));
+  n += got;
+  free(read);
+
+  Snapshot old = {0};
+  Tree old_tree = *tree;
+  swapSnapshot(&old);
+  procs = next;
+  proc_count = n;
+  indexProcs();
+  buildTree(tree);
+
+  // 新出现的进程 重新读取的进程在旧表中也有
+  bool *spawned = calloc(n + 1, sizeof(bool));
+  int spawn_count = 0;
+  for (int i = first_read; i < n; i++)
+  {
+    spawned[i] = pidMapGet(&old.map, procs[i].pid) < 0;
+    spawn_count += spawned[i];
+  }
+
+  char header[96];
+  time_t now = time(NULL);
+  size_t len = strftime(header, sizeof(header), "--- %H:%M:%S: ", localtime(&now));
+  len += snprintf(header + len, sizeof(header) - len, "%d spawned, %d exited ---\n", spawn_count,
+                  exited);
+  bufferAppend(out, header, len);
+
+  // 父进程不是新进程的新进程是一棵新子树的根
+  for (int i = first_read; i < n; i++)
+  {
+    int parent = pidMapGet(&pidMap, procs[i].ppid);
+    if (spawned[i] && (parent < 0 || !spawned[parent]))
+    {
+      appendChange(out, tree, i, '+', show_pid, sort, color ? "\033[32m" : NULL);
+    }
+  }
+
+  // 已退出的子树在旧表中输出 仍然存活的孩子已被收养 从孩子列表中去掉
+  swapSnapshot(&old);
+  for (int i = 0; i < proc_count; i++)
+  {
+    Node *node = &old_tree.nodes[i];
+    int *children = old_tree.children + node->first_child;
+    int kept = 0;
+    for (int k = 0; seen[i] == 0 && k < node->child_count; k++)
+    {
+      if (seen[children[k]] == 0)
+      {
+        children[kept++] = children[k];
+      }
+    }
+    if (seen[i] == 0)
     {
-      printf("\n");
-      printTree(node->children[i], depth + 1, i == node->child_count - 1, show_pid, sort);
+      node->child_count = kept;
     }
   }
+  for (int i = 0; i < proc_count; i++)
+  {
+    int parent = pidMapGet(&pidMap, procs[i].ppid);
+    if (seen[i] == 0 && (parent < 0 || seen[parent] != 0))
+    {
+      appendChange(out, &old_tree, i, '-', show_pid, sort, color ? "\033[31m" : NULL);
+    }
+  }
+  swapSnapshot(&old);
+
+  freeTree(&old_tree);
+  free(old.procs);
+  pidMapFree(&old.map);
+  free(seen);
+  free(spawned);
+  return spawn_count + exited;
+}
+
+// 每隔 interval 秒刷新一次 count 为0时一直运行
+void watchTree(Tree *tree, double interval, int count, int show_pid, int sort)
+{
+  bool color = isatty(STDOUT_FILENO);
+  OutBuf out = {0};
+  struct timespec delay = {(time_t)interval, (long)((interval - (time_t)interval) * 1e9)};
+  for (int i = 0; count == 0 || i < count; i++)
+  {
+    nanosleep(&delay, NULL);
+    if (watchStep(tree, &out, show_pid, sort, color) > 0)
+    {
+      flushOutput(&out);
+    }
+  }
+  free(out.data);
 }
 
 int main(int argc, char *argv[])
 {
   int show_pid = 0;
   int sort = 0;
+  double watch_interval = 0;
+  int watch_count = 0;
   int opt;
   int long_index = 0;
   static struct option long_options[] = {
       {"show-pids", no_argument, 0, 'p'},
       {"numeric-sort", no_argument, 0, 'n'},
       {"version", no_argument, 0, 'V'},
+      {"threads", required_argument, 0, 'T'},
+      {"proc-root", required_argument, 0, 'R'},
+      {"uring", no_argument, 0, 'U'},
+      {"watch", required_argument, 0, 'W'},
+      {"count", required_argument, 0, 'C'},
+      {"usage", no_argument, 0, 'A'},
+      {"sort", required_argument, 0, 'S'},
+      {"min-cpu", required_argument, 0, 'M'},
+      {"min-rss", required_argument, 0, 'K'},
       {0, 0, 0, 0}};
 
   while ((opt = getopt_long(argc, argv, "pnV", long_options, &long_index)) != -1)
@@ -160,7 +703,7 @@ int main(int argc, char *argv[])
       // --numeric-sort
       // 按照 pid 的数值从小到大顺序输出一个进程的直接孩子
       {
-        sort = 1;
+        sort = SORT_PID;
       }
       break;
     case 'V':
@@ -178,195 +721,563 @@ int main(int argc, char *argv[])
         }
       }
       break;
-    default:
-      // 未知选项
-      printUsage();
-      return 1;
-    }
-  }
-
-  Node *nodes[MAX_NODES];
-  int node_count = 0;
-
-  traversePROC();
-  for (int i = 0; i < HASH_SIZE; i++)
-  {
-    if (hashTable[i].pid != 0)
-    {
-
-      int ppid = hashTable[i].ppid;
-      int pid = hashTable[i].pid;
-      Node *parent = findNode(nodes, ppid, node_count);
-      Node *child = findNode(nodes, pid, node_count);
-
-      if (!parent)
+    case 'T':
+      // --threads N
+      // 读取 /proc 的线程数 默认按 CPU 数
       {
-        parent = createNode(ppid);
-        nodes[node_count++] = parent;
+        threadCount = atoi(optarg);
       }
-      if (!child)
+      break;
+    case 'R':
+      // --proc-root DIR
+      // 从 DIR 而不是 /proc 读取进程 用于在模拟的目录树上测量
       {
-        child = createNode(pid);
-        nodes[node_count++] = child;
+        procRoot = optarg;
       }
-      addChild(parent, child);
-    }
-  }
-
-  Node *root = NULL;
-  for (int i = 0; i < node_count; i++)
-  {
-    int is_root = 1;
-    for (int j = 0; j < node_count; j++)
-    {
-      for (int k = 0; k < nodes[j]->child_count; k++)
+      break;
+    case 'U':
+      // --uring
+      // 用 io_uring 批量打开、读取、关闭
       {
-        if (nodes[j]->children[k] == nodes[i])
+        useUring = true;
+      }
+      break;
+    case 'W':
+      // --watch INTERVAL
+      // 每隔 INTERVAL 秒刷新 只输出新出现和已退出的进程
+      {
+        watch_interval = atof(optarg);
+        if (watch_interval <= 0)
         {
-          is_root = 0;
-          break;
+          printf("invalid watch interval: %s\n", optarg);
+          printUsage();
+          return 1;
         }
       }
-      if (!is_root)
-        break;
-    }
-    if (is_root)
-    {
-      root = nodes[i];
       break;
+    case 'C':
+      // --count N
+      // 监视时刷新 N 次后退出
+      {
+        watch_count = atoi(optarg);
+      }
+      break;
+    case 'A':
+      // --usage
+      // 在每个进程后标注自身和子树的 CPU 时间与常驻内存
+      {
+        showUsage = true;
+      }
+      break;
+    case 'S':
+      // --sort pid|cpu|rss
+      // 孩子按进程号 或子树的 CPU 时间、常驻内存从大到小输出
+      {
+        if (strcmp(optarg, "pid") == 0)
+        {
+          sort = SORT_PID;
+        }
+        else if (strcmp(optarg, "cpu") == 0)
+        {
+          sort = SORT_CPU;
+        }
+        else if (strcmp(optarg, "rss") == 0)
+        {
+          sort = SORT_RSS;
+        }
+        else
+        {
+          printf("invalid sort key: %s\n", optarg);
+          printUsage();
+          return 1;
+        }
+      }
+      break;
+    case 'M':
+      // --min-cpu SECONDS
+      // 不输出 CPU 时间之和不到 SECONDS 秒的子树
+      {
+        minCpu = atof(optarg);
+      }
+      break;
+    case 'K':
+      // --min-rss MB
+      // 不输出常驻内存之和不到 MB 的子树
+      {
+        minRss = atof(optarg);
+      }
+      break;
+    default:
+      // 未知选项
+      printUsage();
+      return 1;
     }
   }
 
+  traversePROC();
+
+  Tree tree;
+  buildTree(&tree);
+
   // 打印树
-  if (root)
+  printTree(&tree, show_pid, sort);
+  if (watch_interval > 0)
   {
-    printTree(root, 0, 1, show_pid, sort);
-    printf("\n");
+    watchTree(&tree, watch_interval, watch_count, show_pid, sort);
   }
 
   // 释放内存
-  for (int i = 0; i < node_count; i++)
+  freeTree(&tree);
+  free(procs);
+  pidMapFree(&pidMap);
+
+  return 0;
+}
+
+// 解析 /proc/PID/stat 的内容 成功返回0
+// 进程名在括号中 本身可能含空格和括号 以最后一个 ')' 为界
+int parseStat(const char *buffer, int pid, ProcInfo *info)
+{
+  const char *open_paren = strchr(buffer, '(');
+  const char *close_paren = strrchr(buffer, ')');
+  // 第14、15个字段是 utime、stime 第24个是 rss 字段不全时视为0
+  unsigned long long utime = 0, stime = 0;
+  info->rss = 0;
+  if (open_paren == NULL || close_paren == NULL || close_paren < open_paren ||
+      sscanf(close_paren + 1,
+             " %c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %*d %*d %*u %*u %ld",
+             &info->state, &info->ppid, &utime, &stime, &info->rss) < 2)
   {
-    free(nodes[i]);
+    fprintf(stderr, "Failed to parse %s/%d/stat\n", procRoot, pid);
+    return -1;
   }
 
+  int len = close_paren - open_paren - 1;
+  if (len >= PROC_NAME_LENGTH)
+  {
+    len = PROC_NAME_LENGTH - 1;
+  }
+  memcpy(info->name, open_paren + 1, len);
+  info->name[len] = '\0';
+  info->pid = pid;
+  info->cpu = utime + stime;
   return 0;
 }
 
-int getPPID(int pid)
+// 读取并解析 /proc/PID/stat 成功返回0
+int readProc(int pid, ProcInfo *info)
 {
-  char filename[64];
-  sprintf(filename, "/proc/%d/stat", pid);
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "%s/%d/stat", procRoot, pid);
 
   int fd = open(filename, O_RDONLY);
   if (fd < 0)
   {
-    perror("open");
+    // 读目录之后退出的进程不算错误
+    if (errno != ENOENT && errno != ESRCH)
+    {
+      perror("open");
+    }
     return -1;
   }
 
-  char buffer[256];
+  char buffer[STAT_BUFFER_SIZE];
   ssize_t bytes_read = read(fd, buffer, sizeof(buffer) - 1);
+  close(fd);
   if (bytes_read < 0)
   {
-    perror("read");
-    close(fd);
+    if (errno != ESRCH)
+    {
+      perror("read");
+    }
     return -1;
   }
   buffer[bytes_read] = '\0';
+  return parseStat(buffer, pid, info);
+}
 
-  close(fd);
+// 进程名 取自扫描时的记录 不再读文件
+const char *getName(int pid)
+{
+  int index = pidMapGet(&pidMap, pid);
+  return index < 0 ? "unknown" : procs[index].name;
+}
 
-  int ppid;
-  if (sscanf(buffer, "%*d %*s %*c %d", &ppid) != 1)
+bool isNumber(const char *str)
+{
+  while (*str)
   {
-    fprintf(stderr, "Failed to parse /proc/%d/stat\n", pid);
-    return -1;
+    if (!isdigit((unsigned char)*str))
+    {
+      return false;
+    }
+    str++;
   }
-
-  return ppid;
+  return true;
 }
 
-char *getName(int pid)
-{
-  char filename[64];
-  sprintf(filename, "/proc/%d/stat", pid);
+// ======================== io_uring 读取 ========================
 
-  int fd = open(filename, O_RDONLY);
-  if (fd < 0)
+// 每个进程提交三个链接在一起的请求 openat -> read -> close
+// openat 把文件装进预先登记的空槽 read 和 close 按槽号引用 不需要等 openat 返回 fd
+// 一批 URING_BATCH 个进程只需一次 io_uring_enter 不依赖 liburing 直接用系统调用
+// 空槽登记和 file_index 要 5.19 以后的内核头文件 更旧的头文件编译出的程序只逐个读取
+
+#ifdef IORING_RSRC_REGISTER_SPARSE
+
+// 建立 io_uring 并登记 URING_BATCH 个空的文件槽 成功返回0
+// 内核不支持 io_uring 或空槽登记（5.19 之前）时返回-1
+int uringInit(IoRing *ring)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = syscall(__NR_io_uring_setup, 4 * URING_BATCH, &params);
+  if (ring->fd < 0)
   {
-    perror("open");
-    return strdup("unknown");
+    return -1;
   }
 
-  char buffer[256];
-  ssize_t bytes_read = read(fd, buffer, sizeof(buffer) - 1);
-  if (bytes_read < 0)
+  ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
   {
-    perror("read");
-    close(fd);
-    return strdup("unknown");
+    if (ring->cq_size > ring->sq_size)
+    {
+      ring->sq_size = ring->cq_size;
+    }
+    ring->cq_size = 0;
+  }
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQ_RING);
+  ring->cq_ptr = ring->cq_size == 0 ? ring->sq_ptr
+                                    : mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring->fd, IORING_OFF_SQES);
+  if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED || ring->sqes == MAP_FAILED)
+  {
+    uringExit(ring);
+    return -1;
   }
-  buffer[bytes_read] = '\0';
 
-  close(fd);
+  char *sq = ring->sq_ptr, *cq = ring->cq_ptr;
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
 
-  char *name = (char *)malloc(MAX_NAME_LENGTH);
-  if (name == NULL)
+  struct io_uring_rsrc_register reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.nr = URING_BATCH;
+  reg.flags = IORING_RSRC_REGISTER_SPARSE;
+  if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES2, &reg, sizeof(reg)) < 0)
   {
-    perror("malloc");
-    return strdup("unknown");
+    uringExit(ring);
+    return -1;
   }
+  return 0;
+}
 
-  if (sscanf(buffer, "%*d (%255[^)])", name) != 1)
+void uringExit(IoRing *ring)
+{
+  if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
   {
-    fprintf(stderr, "Failed to parse /proc/%d/stat\n", pid);
-    free(name);
-    return strdup("unknown");
+    munmap(ring->sqes, ring->sqes_size);
   }
+  if (ring->cq_size != 0 && ring->cq_ptr != NULL && ring->cq_ptr != MAP_FAILED)
+  {
+    munmap(ring->cq_ptr, ring->cq_size);
+  }
+  if (ring->sq_ptr != NULL && ring->sq_ptr != MAP_FAILED)
+  {
+    munmap(ring->sq_ptr, ring->sq_size);
+  }
+  close(ring->fd);
+}
 
-  return name;
+// 取下一个提交项 调用者保证一批的请求数不超过队列长度
+struct io_uring_sqe *uringSqe(IoRing *ring, unsigned *tail, int opcode, unsigned long long data)
+{
+  unsigned index = *tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->user_data = data;
+  ring->sq_array[index] = index;
+  (*tail)++;
+  return sqe;
 }
 
-bool isNumber(const char *str)
+// 用 io_uring 读一段进程 结果与 scanWorker 逐个读取相同 返回读到的进程数
+// 除进程已退出以外的错误 如旧内核不支持 openat 装入文件槽 逐个退回 readProc
+int uringReadSlice(IoRing *ring, ScanTask *task)
 {
-  while (*str)
+  char(*paths)[URING_PATH] = malloc(URING_BATCH * URING_PATH);
+  char(*buffers)[STAT_BUFFER_SIZE] = malloc(URING_BATCH * STAT_BUFFER_SIZE);
+  int open_res[URING_BATCH], read_res[URING_BATCH];
+  int read = 0;
+  bool usable = true, inflight = false;
+
+  for (int begin = 0; begin < task->count; begin += URING_BATCH)
   {
-    if (!isdigit((unsigned char)*str))
+    int n = task->count - begin < URING_BATCH ? task->count - begin : URING_BATCH;
+    if (!usable)
     {
-      return false;
+      // io_uring_enter 出过错 队列里可能还留着没提交的请求 这一段剩下的逐个读取
+      for (int k = 0; k < n; k++)
+      {
+        read += readProc(task->pids[begin + k], &task->out[read]) == 0;
+      }
+      continue;
+    }
+    unsigned tail = *ring->sq_tail;
+    for (int k = 0; k < n; k++)
+    {
+      snprintf(paths[k], URING_PATH, "%s/%d/stat", procRoot, task->pids[begin + k]);
+      open_res[k] = read_res[k] = -ECANCELED;
+
+      struct io_uring_sqe *sqe = uringSqe(ring, &tail, IORING_OP_OPENAT, 3 * k);
+      sqe->fd = AT_FDCWD;
+      sqe->addr = (unsigned long)paths[k];
+      sqe->open_flags = O_RDONLY; // 装入文件槽时不能带 O_CLOEXEC 否则 EINVAL
+      sqe->file_index = k + 1; // 槽号加一 0表示普通 fd
+      sqe->flags = IOSQE_IO_LINK;
+
+      sqe = uringSqe(ring, &tail, IORING_OP_READ, 3 * k + 1);
+      sqe->fd = k;
+      sqe->addr = (unsigned long)buffers[k];
+      sqe->len = STAT_BUFFER_SIZE - 1;
+      // 读不满 len 也算链断开 用硬链接让 close 照样执行
+      sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+
+      // 打开失败时链上的读和 close 被取消 槽是空的 留给下一批的 openat
+      sqe = uringSqe(ring, &tail, IORING_OP_CLOSE, 3 * k + 2);
+      sqe->file_index = k + 1;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    // 提交并等待全部完成
+    // 出错后不再提交 但已提交的请求还会写 paths 和 buffers 等它们完成后才能复用或释放
+    // 没提交的请求永远不会完成 不计入等待的数量
+    int pending = 3 * n, to_submit = 3 * n;
+    while (pending > (usable ? 0 : to_submit))
+    {
+      int ret = syscall(__NR_io_uring_enter, ring->fd, usable ? to_submit : 0,
+                        pending - (usable ? 0 : to_submit), IORING_ENTER_GETEVENTS, NULL, 0);
+      if (ret < 0 && errno != EINTR)
+      {
+        if (!usable)
+        {
+          inflight = true;
+          break;
+        }
+        usable = false;
+        continue;
+      }
+      if (ret > 0 && usable)
+      {
+        to_submit -= ret < to_submit ? ret : to_submit;
+      }
+      unsigned head = *ring->cq_head;
+      unsigned cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+      for (; head != cq_tail; head++)
+      {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        int k = cqe->user_data / 3;
+        if (cqe->user_data % 3 == 0)
+        {
+          open_res[k] = cqe->res;
+        }
+        else if (cqe->user_data % 3 == 1)
+        {
+          read_res[k] = cqe->res;
+        }
+        pending--;
+      }
+      __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    for (int k = 0; k < n; k++)
+    {
+      int pid = task->pids[begin + k];
+      ProcInfo *info = &task->out[read];
+      if (read_res[k] >= 0)
+      {
+        buffers[k][read_res[k]] = '\0';
+        read += parseStat(buffers[k], pid, info) == 0;
+      }
+      else if (open_res[k] != -ENOENT && open_res[k] != -ESRCH && read_res[k] != -ESRCH)
+      {
+        read += readProc(pid, info) == 0;
+      }
     }
-    str++;
   }
-  return true;
+  if (!inflight)
+  {
+    // 连等待都失败时 内核可能还在写这两块内存 宁可泄漏也不释放
+    free(paths);
+    free(buffers);
+  }
+  return read;
+}
+#else
+int uringInit(IoRing *ring)
+{
+  (void)ring;
+  return -1;
 }
 
-void traversePROC(void)
+void uringExit(IoRing *ring)
+{
+  (void)ring;
+}
+
+int uringReadSlice(IoRing *ring, ScanTask *task)
+{
+  (void)ring;
+  (void)task;
+  return 0;
+}
+#endif
+
+// 读取线程 依次读一段进程
+void *scanWorker(void *arg)
+{
+  ScanTask *task = arg;
+  task->read = 0;
+  IoRing ring;
+  if (useUring && strlen(procRoot) + 16 < URING_PATH && uringInit(&ring) == 0)
+  {
+    task->read = uringReadSlice(&ring, task);
+    uringExit(&ring);
+    return NULL;
+  }
+  for (int i = 0; i < task->count; i++)
+  {
+    if (readProc(task->pids[i], &task->out[task->read]) == 0)
+    {
+      task->read++;
+    }
+  }
+  return NULL;
+}
+
+// 列出 procRoot 中的进程号 返回个数 *pids 需要 free
+int listPids(int **pids)
 {
   DIR *dir;
   struct dirent *entry;
 
-  dir = opendir("/proc");
+  *pids = NULL;
+  dir = opendir(procRoot);
   if (dir == NULL)
   {
     perror("opendir");
-    return;
+    return 0;
   }
 
+  int count = 0, capacity = 0;
   while ((entry = readdir(dir)) != NULL)
   {
     if (isNumber(entry->d_name))
     {
-      // 进程号
-      int pid = atoi(entry->d_name);
-      int ppid = getPPID(pid);
-      if (ppid != -1)
+      if (count == capacity)
       {
-        insertHash(pid, ppid);
+        capacity = capacity ? capacity * 2 : 1024;
+        *pids = realloc(*pids, capacity * sizeof(int));
       }
+      // 进程号
+      (*pids)[count++] = atoi(entry->d_name);
     }
   }
   closedir(dir);
+  return count;
+}
+
+// 读取一组进程 把它们分成连续的几段 由多个线程同时读取 返回读到的进程数
+// 第 t 段的结果写在 out 中与它在 pids 中相同的位置 读完后依次前移 合成连续的数组
+int scanPids(const int *pids, int count, ProcInfo *out)
+{
+  // 没有指定线程数时 每个线程至少分到 MIN_PROCS_PER_THREAD 个进程
+  int threads = threadCount;
+  if (threads <= 0)
+  {
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > count / MIN_PROCS_PER_THREAD)
+    {
+      threads = count / MIN_PROCS_PER_THREAD;
+    }
+  }
+  if (threads > count)
+  {
+    threads = count;
+  }
+  if (threads > MAX_THREADS)
+  {
+    threads = MAX_THREADS;
+  }
+  if (threads < 1)
+  {
+    threads = 1;
+  }
+
+  ScanTask tasks[MAX_THREADS];
+  pthread_t tids[MAX_THREADS];
+  bool started[MAX_THREADS] = {false};
+  for (int t = 0; t < threads; t++)
+  {
+    int begin = (long)count * t / threads;
+    int end = (long)count * (t + 1) / threads;
+    tasks[t] = (ScanTask){.pids = pids + begin, .count = end - begin, .out = out + begin};
+  }
+  // 第0段由主线程读 创建线程失败的段也由主线程读
+  for (int t = 1; t < threads; t++)
+  {
+    started[t] = pthread_create(&tids[t], NULL, scanWorker, &tasks[t]) == 0;
+  }
+  scanWorker(&tasks[0]);
+  int read = 0;
+  for (int t = 0; t < threads; t++)
+  {
+    if (started[t])
+    {
+      pthread_join(tids[t], NULL);
+    }
+    else if (t > 0)
+    {
+      scanWorker(&tasks[t]);
+    }
+    memmove(out + read, tasks[t].out, tasks[t].read * sizeof(ProcInfo));
+    read += tasks[t].read;
+  }
+  return read;
+}
+
+// 扫描 procRoot 中的所有进程 结果在 procs 中
+void traversePROC(void)
+{
+  int *pids;
+  int count = listPids(&pids);
+  procs = realloc(procs, (count > 0 ? count : 1) * sizeof(ProcInfo));
+  proc_count = scanPids(pids, count, procs);
+  free(pids);
+  indexProcs();
+}
+
+// 按 PID 建立 procs 的索引
+void indexProcs(void)
+{
+  pidMapFree(&pidMap);
+  pidMapInit(&pidMap, proc_count);
+  for (int i = 0; i < proc_count; i++)
+  {
+    pidMapPut(&pidMap, procs[i].pid, i);
+  }
 }
 
 int compareInt(const void *a, const void *b)
@@ -384,22 +1295,17 @@ int compareInt(const void *a, const void *b)
 void printPID(void)
 {
   traversePROC();
-  int array[HASH_SIZE] = {0};
-  for (int i = 0; i < HASH_SIZE; i++)
+  int *array = malloc(proc_count * sizeof(int));
+  for (int i = 0; i < proc_count; i++)
   {
-    if (hashTable[i].pid != 0)
-    {
-      array[i] = hashTable[i].pid;
-    }
+    array[i] = procs[i].pid;
   }
-  qsort(array, HASH_SIZE, sizeof(int), compareInt);
-  for (int i = 0; i < HASH_SIZE; i++)
+  qsort(array, proc_count, sizeof(int), compareInt);
+  for (int i = 0; i < proc_count; i++)
   {
-    if (array[i] != 0)
-    {
-      printf("%d\n", array[i]);
-    }
+    printf("%d\n", array[i]);
   }
+  free(array);
 }
 
 void printVersion(void)
@@ -415,9 +1321,20 @@ void printUsage(void)
 {
   printf("\n");
   printf("Usage:\n");
-  printf("pstree [-p] [-n] [-V]\n");
+  printf("pstree [-p] [-n] [-V] [--threads N] [--proc-root DIR] [--uring]\n");
+  printf("       [--watch INTERVAL [--count N]] [--usage] [--sort pid|cpu|rss]\n");
+  printf("       [--min-cpu SECONDS] [--min-rss MB]\n");
   printf("-p or --show-pids: print each process's pid\n");
   printf("-n or --numeric-sort: sort processes by pid in ascending order\n");
   printf("-V or --version: print version information\n");
+  printf("--threads N: read /proc with N threads (default: one per CPU)\n");
+  printf("--proc-root DIR: read processes from DIR instead of /proc\n");
+  printf("--uring: batch /proc reads through io_uring (faster only with spare cores)\n");
+  printf("--watch INTERVAL: refresh every INTERVAL seconds, printing spawned and exited subtrees\n");
+  printf("--count N: with --watch, stop after N refreshes\n");
+  printf("--usage: annotate each process with its own/subtree CPU time and RSS\n");
+  printf("--sort pid|cpu|rss: order children by pid, or by subtree CPU time or RSS (largest first)\n");
+  printf("--min-cpu SECONDS: hide subtrees whose total CPU time is below SECONDS\n");
+  printf("--min-rss MB: hide subtrees whose total RSS is below MB (shared pages are counted per process)\n");
   printf("\n");
 }
\ No newline at end of file
@@ -1,23 +1,132 @@
-#define HASH_SIZE 1000
-#define MAX_NODES 1000
+#include <stddef.h>
+#include <stdbool.h>
+
 #define MAX_NAME_LENGTH 256
+#define STAT_BUFFER_SIZE 512 // 读取 /proc/PID/stat 的缓冲区大小
+#define PROC_NAME_LENGTH 64  // 进程名的最大长度 内核线程的名字可能超过16个字符
+#define MAX_THREADS 16           // 并行读取 /proc 的最大线程数
+#define MIN_PROCS_PER_THREAD 256 // 每个线程至少分到的进程数 进程少时线程的开销不值得
+#define URING_BATCH 128          // io_uring 每次提交的进程数 每个进程 open、read、close 三个请求
+#define URING_PATH 256           // io_uring 读取时 stat 文件路径的最大长度
+#define OUTPUT_INITIAL (1 << 16) // 输出缓冲区的初始大小 按需翻倍
+
+// 孩子的输出顺序
+#define SORT_NONE 0 // 读取 /proc 的顺序
+#define SORT_PID 1  // 进程号从小到大
+#define SORT_CPU 2  // 子树的 CPU 时间从大到小
+#define SORT_RSS 3  // 子树的常驻内存从大到小
 
+// PID 到 procs 下标的哈希表 开放定址 线性探测
+// 容量是2的幂 不小于进程数的两倍 探测序列很短
+typedef struct
+{
+  int *keys;   // PID 0表示空槽
+  int *values; // 在 procs 中的下标
+  int mask;    // 容量减一
+} PidMap;
+
+// 一次读取 /proc/PID/stat 得到的进程信息 建树和打印都用它
 typedef struct
 {
   int pid;
   int ppid;
-} HashNode;
+  char state;
+  char name[PROC_NAME_LENGTH];
+  unsigned long long cpu; // utime + stime 单位为时钟滴答
+  long rss;               // 常驻内存 单位为页
+} ProcInfo;
 
-typedef struct Node
+// 资源用量 与 ProcInfo 中的单位相同
+typedef struct
 {
-  int pid;
-  struct Node *children[MAX_NODES];
+  unsigned long long cpu;
+  long rss;
+} Usage;
+
+// 一个读取线程的任务
+// 读 pids 中的一段 结果从 out 开始连续写入 各线程写互不重叠的区间 不需要加锁
+typedef struct
+{
+  const int *pids;
+  int count;
+  ProcInfo *out;
+  int read; // 实际读到的进程数 读目录之后退出的进程不计
+} ScanTask;
+
+// io_uring 的共享内存 只包含读取 /proc 用到的部分
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+typedef struct
+{
+  int fd;
+  unsigned *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ptr, *cq_ptr;
+  size_t sq_size, cq_size, sqes_size;
+} IoRing;
+
+// 某一时刻的进程表 --watch 保留上一次的 与全局的 procs、proc_count、pidMap 交换使用
+typedef struct
+{
+  ProcInfo *procs;
+  int count;
+  PidMap map;
+} Snapshot;
+
+// 输出缓冲区 整棵树写进来之后一次写出
+typedef struct
+{
+  char *data;
+  size_t len;
+  size_t cap;
+} OutBuf;
+
+// 树的节点 与 procs 按下标一一对应
+// 孩子的下标在 Tree.children 中连续存放 [first_child, first_child + child_count)
+typedef struct
+{
+  int first_child;
   int child_count;
 } Node;
 
+// 进程树 所有节点和孩子列表各是一块连续的数组 内存为 O(n)
+typedef struct
+{
+  Node *nodes;
+  int *children; // 按父节点分段 段内保持 procs 中的顺序
+  int *roots;    // 父进程不在 /proc 中的进程
+  int root_count;
+  Usage *total;  // 以每个节点为根的子树的用量之和 含节点自身
+} Tree;
+
+void pidMapInit(PidMap *map, int count);
+void pidMapPut(PidMap *map, int pid, int value);
+int pidMapGet(const PidMap *map, int pid);
+void pidMapFree(PidMap *map);
+int listPids(int **pids);
+int scanPids(const int *pids, int count, ProcInfo *out);
 void traversePROC(void);
+void indexProcs(void);
+void buildTree(Tree *tree);
+void sumUsage(Tree *tree);
+void freeTree(Tree *tree);
+int filterNodes(const Tree *tree, int *nodes, int count);
+void sortNodes(const Tree *tree, int *nodes, int count, int sort);
 void printPID(void);
-void printTree(Node *node, int depth, int is_last_child, int show_pid, int sort);
-char *getName(int pid);
+void bufferAppend(OutBuf *out, const char *data, size_t len);
+void renderTree(OutBuf *out, const Tree *tree, int root, int show_pid, int sort);
+void flushOutput(OutBuf *out);
+void printTree(const Tree *tree, int show_pid, int sort);
+int watchStep(Tree *tree, OutBuf *out, int show_pid, int sort, bool color);
+void watchTree(Tree *tree, double interval, int count, int show_pid, int sort);
+int parseStat(const char *buffer, int pid, ProcInfo *info);
+int readProc(int pid, ProcInfo *info);
+int uringInit(IoRing *ring);
+void uringExit(IoRing *ring);
+int uringReadSlice(IoRing *ring, ScanTask *task);
+const char *getName(int pid);
 void printVersion(void);
 void printUsage(void);
\ No newline at end of file
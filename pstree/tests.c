@@ -3,6 +3,313 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "pstree.h"
+
+extern ProcInfo *procs;
+extern int proc_count;
+extern const char *procRoot;
+extern int threadCount;
+extern bool useUring;
+extern double minCpu;
+
+#define FAKE_PROCS 2000
+
+// Builds a /proc-like tree: FAKE_PROCS numeric dirs with a stat file each,
+// plus a few non-process entries that must be skipped. Prefers tmpfs:
+// creating thousands of files on a disk-backed /tmp can take longer than
+// the unit test time limit
+static char fake_root[64];
+
+static void make_fake_proc(void)
+{
+       strcpy(fake_root, "/dev/shm/pstree-proc-XXXXXX");
+       if (mkdtemp(fake_root) == NULL)
+       {
+              strcpy(fake_root, "/tmp/pstree-proc-XXXXXX");
+              tk_assert(mkdtemp(fake_root) != NULL, "mkdtemp should succeed");
+       }
+       char path[128];
+       for (int pid = 1; pid <= FAKE_PROCS; pid++)
+       {
+              snprintf(path, sizeof(path), "%s/%d", fake_root, pid);
+              mkdir(path, 0755);
+              snprintf(path, sizeof(path), "%s/%d/stat", fake_root, pid);
+              FILE *fp = fopen(path, "w");
+              // names with spaces and parentheses, as in real comm fields
+              fprintf(fp, "%d (w (%d) x) S %d 1 1 0 -1\n", pid, pid, pid / 4);
+              fclose(fp);
+       }
+       snprintf(path, sizeof(path), "%s/self", fake_root);
+       mkdir(path, 0755);
+}
+
+static void remove_fake_proc(void)
+{
+       char path[128];
+       for (int pid = 1; pid <= FAKE_PROCS; pid++)
+       {
+              snprintf(path, sizeof(path), "%s/%d/stat", fake_root, pid);
+              unlink(path);
+              snprintf(path, sizeof(path), "%s/%d", fake_root, pid);
+              rmdir(path);
+       }
+       snprintf(path, sizeof(path), "%s/self", fake_root);
+       rmdir(path);
+       rmdir(fake_root);
+}
+
+static double scan_ms(int threads)
+{
+       struct timespec t0, t1;
+       threadCount = threads;
+       clock_gettime(CLOCK_MONOTONIC, &t0);
+       traversePROC();
+       clock_gettime(CLOCK_MONOTONIC, &t1);
+       return (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+}
+
+// ======================== Unit Tests ========================
+
+// PIDs that collided in the old pid % 1000 table must all be kept
+UnitTest(pid_map_collisions)
+{
+       PidMap map;
+       pidMapInit(&map, 5000);
+       for (int i = 0; i < 5000; i++)
+       {
+              pidMapPut(&map, 1 + i * 1000, i);
+       }
+       for (int i = 0; i < 5000; i++)
+       {
+              tk_assert(pidMapGet(&map, 1 + i * 1000) == i,
+                        "PID %d should map to %d", 1 + i * 1000, i);
+       }
+       tk_assert(pidMapGet(&map, 2) == -1, "Missing PID should not be found");
+       pidMapFree(&map);
+}
+
+// A synthetic 100k-process tree: every process i > 1 is a child of i / 8,
+// with pids listed in reverse so children come before their parents
+UnitTest(build_tree_100k)
+{
+       proc_count = 100000;
+       procs = calloc(proc_count, sizeof(ProcInfo));
+       for (int i = 0; i < proc_count; i++)
+       {
+              procs[i].pid = proc_count - i;
+              procs[i].ppid = procs[i].pid / 8;
+       }
+       indexProcs();
+       Tree tree;
+       buildTree(&tree);
+       tk_assert(tree.root_count == 7, "PIDs 1..7 should be roots, got %d", tree.root_count);
+       int total = 0;
+       for (int i = 0; i < proc_count; i++)
+       {
+              const Node *node = &tree.nodes[i];
+              for (int k = 0; k < node->child_count; k++)
+              {
+                     int child = tree.children[node->first_child + k];
+                     tk_assert(procs[child].ppid == procs[i].pid, "Child %d linked under %d",
+                               procs[child].pid, procs[i].pid);
+              }
+              total += node->child_count;
+       }
+       tk_assert(total + tree.root_count == proc_count, "Every process should appear once");
+       freeTree(&tree);
+}
+
+// Scanning with 1 and 4 threads must give the same records in the same
+// order; the timings are printed for comparison (TK_VERBOSE shows them)
+UnitTest(parallel_scan)
+{
+       make_fake_proc();
+       procRoot = fake_root;
+       double serial = scan_ms(1);
+       tk_assert(proc_count == FAKE_PROCS, "Expected %d processes, got %d", FAKE_PROCS, proc_count);
+       ProcInfo *expected = malloc(proc_count * sizeof(ProcInfo));
+       memcpy(expected, procs, proc_count * sizeof(ProcInfo));
+
+       double parallel = scan_ms(4);
+       tk_assert(proc_count == FAKE_PROCS, "Expected %d processes, got %d", FAKE_PROCS, proc_count);
+       for (int i = 0; i < proc_count; i++)
+       {
+              tk_assert(procs[i].pid == expected[i].pid && procs[i].ppid == expected[i].ppid &&
+                            strcmp(procs[i].name, expected[i].name) == 0,
+                        "Record %d differs between 1 and 4 threads", i);
+       }
+       tk_assert(strcmp(procs[0].name, expected[0].name) == 0 && strncmp(procs[0].name, "w (", 3) == 0,
+                 "Names with parentheses should be kept whole, got %s", procs[0].name);
+       printf("%d stat files: 1 thread %.2f ms, 4 threads %.2f ms\n", FAKE_PROCS, serial, parallel);
+       free(expected);
+       remove_fake_proc();
+}
+
+// The io_uring reader must agree with the one-open-per-file reader,
+// including a stat file that vanished after the directory was listed
+UnitTest(uring_scan)
+{
+       make_fake_proc();
+       procRoot = fake_root;
+       char path[128];
+       snprintf(path, sizeof(path), "%s/7/stat", fake_root);
+       unlink(path);
+
+       useUring = false;
+       scan_ms(2);
+       tk_assert(proc_count == FAKE_PROCS - 1, "Expected %d processes, got %d", FAKE_PROCS - 1, proc_count);
+       ProcInfo *expected = malloc(proc_count * sizeof(ProcInfo));
+       memcpy(expected, procs, proc_count * sizeof(ProcInfo));
+
+       useUring = true;
+       scan_ms(2);
+       tk_assert(proc_count == FAKE_PROCS - 1, "Expected %d processes, got %d", FAKE_PROCS - 1, proc_count);
+       for (int i = 0; i < proc_count; i++)
+       {
+              tk_assert(procs[i].pid == expected[i].pid && procs[i].ppid == expected[i].ppid &&
+                            procs[i].state == expected[i].state &&
+                            strcmp(procs[i].name, expected[i].name) == 0,
+                        "Record %d differs between io_uring and plain reads", i);
+       }
+       free(expected);
+       remove_fake_proc();
+}
+
+// Siblings below a non-last child share a "│ " continuation prefix
+UnitTest(render_prefix_stack)
+{
+       static const struct { int pid, ppid; const char *name; } rows[] = {
+              {1, 0, "init"}, {2, 1, "a"}, {3, 1, "b"}, {4, 2, "c"}, {5, 4, "d"}, {6, 2, "e"},
+       };
+       proc_count = sizeof(rows) / sizeof(rows[0]);
+       procs = calloc(proc_count, sizeof(ProcInfo));
+       for (int i = 0; i < proc_count; i++)
+       {
+              procs[i].pid = rows[i].pid;
+              procs[i].ppid = rows[i].ppid;
+              strcpy(procs[i].name, rows[i].name);
+       }
+       indexProcs();
+       Tree tree;
+       buildTree(&tree);
+       OutBuf out = {0};
+       renderTree(&out, &tree, tree.roots[0], 1, 1);
+       bufferAppend(&out, "", 1);
+       const char *expected = "init(1)\n"
+                              "├─a(2)\n"
+                              "│ ├─c(4)\n"
+                              "│ │ └─d(5)\n"
+                              "│ └─e(6)\n"
+                              "└─b(3)\n";
+       tk_assert(strcmp(out.data, expected) == 0, "Unexpected rendering:\n%s", out.data);
+       free(out.data);
+       freeTree(&tree);
+}
+
+// utime/stime/rss come from the same stat line; subtree totals drive
+// --sort cpu and prune light subtrees along with their children
+UnitTest(usage_totals)
+{
+       ProcInfo parsed;
+       const char *line = "42 (a b) S 1 42 42 0 -1 4194560 100 0 0 0 "
+                          "250 50 0 0 20 0 1 0 1234 10000000 300 18446744073709551615\n";
+       tk_assert(parseStat(line, 42, &parsed) == 0 && parsed.ppid == 1 && parsed.cpu == 300 &&
+                     parsed.rss == 300,
+                 "Expected ppid 1, cpu 300, rss 300, got %d %llu %ld", parsed.ppid, parsed.cpu,
+                 parsed.rss);
+
+       unsigned long long tick = sysconf(_SC_CLK_TCK);
+       static const struct { int pid, ppid, cpu; const char *name; } rows[] = {
+              {1, 0, 1, "init"}, {2, 1, 1, "light"}, {3, 1, 1, "shell"}, {4, 3, 5, "make"},
+              {5, 4, 0, "cc"}, {6, 2, 0, "idle"},
+       };
+       proc_count = sizeof(rows) / sizeof(rows[0]);
+       procs = calloc(proc_count, sizeof(ProcInfo));
+       for (int i = 0; i < proc_count; i++)
+       {
+              procs[i].pid = rows[i].pid;
+              procs[i].ppid = rows[i].ppid;
+              procs[i].cpu = rows[i].cpu * tick;
+              procs[i].rss = 1;
+              strcpy(procs[i].name, rows[i].name);
+       }
+       indexProcs();
+       Tree tree;
+       buildTree(&tree);
+       tk_assert(tree.total[0].cpu == 8 * tick && tree.total[0].rss == 6 && tree.total[2].cpu == 6 * tick,
+                 "Unexpected subtree totals");
+
+       OutBuf out = {0};
+       renderTree(&out, &tree, tree.roots[0], 0, SORT_CPU);
+       bufferAppend(&out, "", 1);
+       tk_assert(strcmp(out.data, "init\n├─shell\n│ └─make\n│   └─cc\n└─light\n  └─idle\n") == 0,
+                 "Heavier subtree should come first:\n%s", out.data);
+
+       out.len = 0;
+       minCpu = 1;
+       renderTree(&out, &tree, tree.roots[0], 0, SORT_PID);
+       bufferAppend(&out, "", 1);
+       minCpu = 0;
+       tk_assert(strcmp(out.data, "init\n├─light\n└─shell\n  └─make\n") == 0,
+                 "Subtrees under 1s should be pruned:\n%s", out.data);
+       free(out.data);
+       freeTree(&tree);
+}
+
+// A refresh re-reads only the changed pids and prints the spawned
+// subtree under its parent and the exited process without its
+// still-running children
+UnitTest(watch_diff)
+{
+       make_fake_proc();
+       procRoot = fake_root;
+       Tree tree;
+       traversePROC();
+       buildTree(&tree);
+
+       char path[128];
+       int spawned[][2] = {{5000, 7}, {5001, 5000}};
+       for (int i = 0; i < 2; i++)
+       {
+              snprintf(path, sizeof(path), "%s/%d", fake_root, spawned[i][0]);
+              mkdir(path, 0755);
+              snprintf(path, sizeof(path), "%s/%d/stat", fake_root, spawned[i][0]);
+              FILE *fp = fopen(path, "w");
+              fprintf(fp, "%d (w (%d) x) S %d 1 1 0 -1\n", spawned[i][0], spawned[i][0], spawned[i][1]);
+              fclose(fp);
+       }
+       snprintf(path, sizeof(path), "%s/9/stat", fake_root);
+       unlink(path);
+       snprintf(path, sizeof(path), "%s/9", fake_root);
+       rmdir(path);
+
+       OutBuf out = {0};
+       int changes = watchStep(&tree, &out, 1, 1, false);
+       bufferAppend(&out, "", 1);
+       tk_assert(changes == 3, "Expected 2 spawned and 1 exited, got %d changes", changes);
+       tk_assert(strstr(out.data, "2 spawned, 1 exited") != NULL, "Missing summary:\n%s", out.data);
+       tk_assert(strstr(out.data, "+ w (7) x(7):\nw (5000) x(5000)\n└─w (5001) x(5001)\n") != NULL,
+                 "Spawned subtree not shown under its parent:\n%s", out.data);
+       tk_assert(strstr(out.data, "- w (2) x(2):\nw (9) x(9)\n") != NULL && strstr(out.data, "(36)") == NULL,
+                 "Exited process not shown alone under its parent:\n%s", out.data);
+       tk_assert(proc_count == FAKE_PROCS + 1, "Expected %d processes, got %d", FAKE_PROCS + 1, proc_count);
+
+       out.len = 0;
+       tk_assert(watchStep(&tree, &out, 1, 1, false) == 0 && out.len == 0, "An unchanged tree should print nothing");
+       free(out.data);
+       freeTree(&tree);
+       for (int i = 0; i < 2; i++)
+       {
+              snprintf(path, sizeof(path), "%s/%d/stat", fake_root, spawned[i][0]);
+              unlink(path);
+              snprintf(path, sizeof(path), "%s/%d", fake_root, spawned[i][0]);
+              rmdir(path);
+       }
+       remove_fake_proc();
+}
 
 // ======================== System Tests ========================
 
@@ -120,6 +427,26 @@ SystemTest(all_options_long,
                  "Output should contain PIDs in parentheses");
 }
 
+SystemTest(watch_refresh,
+           ((const char *[]){"--watch", "0.05", "--count", "2"}))
+{
+       tk_assert(result->exit_status == 0,
+                 "pstree --watch should exit with status 0 after --count refreshes, got %d",
+                 result->exit_status);
+       tk_assert(strlen(result->output) > 0,
+                 "Output should not be empty");
+}
+
+SystemTest(usage_sorted,
+           ((const char *[]){"--usage", "--sort", "rss"}))
+{
+       tk_assert(result->exit_status == 0,
+                 "pstree --usage --sort rss should exit with status 0, got %d",
+                 result->exit_status);
+       tk_assert(strstr(result->output, " [cpu ") != NULL && strstr(result->output, " rss ") != NULL,
+                 "Output should contain CPU and RSS annotations");
+}
+
 SystemTest(invalid_option,
            ((const char *[]){"--invalid-option"}))
 {
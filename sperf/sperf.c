@@ -1,324 +1,3494 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <signal.h>
-#include <regex.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/signalfd.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <elf.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
-#include <sys/time.h>
+#include <limits.h>
+#include <sys/timerfd.h>
+#include <linux/perf_event.h>
+
+#include "sperf.h"
+#include "syscalls.h"
+
+syscall_stats stats;
+
+// 按文件描述符的统计 --fds 时才分配
+static fd_tracker *fd_live;
+
+// 调用栈存储 --stacks 时才分配
+static stack_node *stack_nodes;
+
+// 报告用的快照 与 stats 分离 排序不会打乱正在更新的表
+static syscall_stats snapshot;
+static syscall_stats fd_snapshot;
 
-double cnt = 0.0;
-#define MAX_SYSCALLS 1024 // 最大系统调用数
-#define TOP_N 5           // 输出前TOP_N个系统调用
-#define MAX_MATCHES 2     // 正则匹配结果数
-#define INTERVAL_MS 1000  // 1000ms更新
+// 跟踪开始的时间 用于报告中的 Time 行
+static struct timespec start_time;
 
-// 一种系统调用的统计信息
+// 每次调用要扣除的跟踪开销 单位秒 --correct 时由校准得出
+static double time_bias;
+
+// 跨 read() 边界的未完整行
 typedef struct
 {
-    char name[64];
-    double total_time;
-    int count;
-} syscall_stat;
+    char buf[MAX_LINE];
+    size_t len;
+} line_buffer;
 
-// 所有系统调用统计信息
-typedef struct
+/**
+ * @brief 耗时对应的直方图桶
+ * @param time 耗时 单位秒
+ * @return 桶下标 第i个桶覆盖 [2^(i-1), 2^i) ns
+ * @note 超出范围的落在最后一个桶
+ */
+static int hist_bucket(double time)
 {
-    syscall_stat stats[MAX_SYSCALLS];
-    int count;
-    double total_time;
-} syscall_stats;
+    uint64_t ns = (uint64_t)(time * 1e9);
+    if (ns == 0)
+        return 0;
+    int b = 64 - __builtin_clzll(ns);
+    return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;
+}
 
-syscall_stats stats;
+/**
+ * @brief 扣除跟踪本身计入的耗时
+ * @param time 后端测得的耗时 单位秒
+ * @return 校正后的耗时 不小于0
+ * @note 未校准时 time_bias 为0 原样返回
+ */
+static double corrected_time(double time)
+{
+    return time > time_bias ? time - time_bias : 0;
+}
 
-// 正则表达式
-// 系统调用名称匹配     时间匹配
-regex_t name_regex, time_regex;
+/**
+ * @brief 计算系统调用名称的哈希值
+ * @param name 名称 不要求以\0结尾
+ * @param len 名称长度
+ * @return FNV-1a 哈希值
+ * @note none
+ */
+static uint32_t name_hash(const char *name, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
 
 /**
- * @brief 初始化 编译正则表达式
- * @param void
- * @return 0 on success, -1 on failure
- * @note 编译后的表达式赋值给 name_regex 和 time_regex
- *       编译失败时会打印错误信息并返回-1
+ * @brief 查找系统调用对应的统计项
+ * @param stats 系统调用统计信息
+ * @param name 系统调用名称 不要求以\0结尾
+ * @param len 名称长度
+ * @return 统计项下标 不存在时返回-1
+ * @note 只读 不会新建
  */
-int regex_init(void)
+int stat_find(const syscall_stats *stats, const char *name, size_t len)
 {
-    // 系统调用名称匹配：以字母开头，后跟左括号
-    // 时间匹配：以小数点或数字开头，后跟小数点或数字结尾
-    if (regcomp(&name_regex, "^([a-zA-Z]+)\\(", REG_EXTENDED) != 0 ||
-        regcomp(&time_regex, "<([0-9.]+)>", REG_EXTENDED) != 0)
+    uint32_t h = name_hash(name, len) & (STAT_INDEX_SIZE - 1);
+    while (stats->index[h] != 0)
     {
-        fprintf(stderr, "Regex compilation failed\n");
-        return -1;
+        const syscall_stat *st = &stats->stats[stats->index[h] - 1];
+        if (strncmp(st->name, name, len) == 0 && st->name[len] == '\0')
+            return stats->index[h] - 1;
+        h = (h + 1) & (STAT_INDEX_SIZE - 1);
     }
-    return 0;
+    return -1;
 }
 
 /**
- * @brief 清理正则表达式资源
- * @param void
- * @return void
- * @note none
+ * @brief 查找系统调用对应的统计项 不存在时新建
+ * @param stats 系统调用统计信息
+ * @param name 系统调用名称 不要求以\0结尾
+ * @param len 名称长度
+ * @return 统计项 表满或名字过长时返回NULL
+ * @note 通过开放寻址的索引查找 不再逐个 strcmp
  */
-void regex_cleanup(void)
+syscall_stat *stat_lookup(syscall_stats *stats, const char *name, size_t len)
 {
-    regfree(&name_regex);
-    regfree(&time_regex);
+    if (len == 0 || len >= sizeof(stats->stats[0].name))
+        return NULL;
+
+    uint32_t h = name_hash(name, len) & (STAT_INDEX_SIZE - 1);
+    while (stats->index[h] != 0)
+    {
+        syscall_stat *st = &stats->stats[stats->index[h] - 1];
+        if (strncmp(st->name, name, len) == 0 && st->name[len] == '\0')
+            return st;
+        h = (h + 1) & (STAT_INDEX_SIZE - 1);
+    }
+
+    // 新增系统调用
+    if (stats->count >= MAX_SYSCALLS)
+        return NULL;
+    syscall_stat *st = &stats->stats[stats->count++];
+    memset(st, 0, sizeof(*st));
+    memcpy(st->name, name, len);
+    stats->index[h] = stats->count;
+    return st;
 }
 
 /**
- * @brief 解析strace输出行
- * @param line 待解析的strace输出行
- * @param stats 系统调用统计信息 全局变量
+ * @brief 记录一次系统调用
+ * @param stats 系统调用统计信息
+ * @param name 系统调用名称 不要求以\0结尾
+ * @param len 名称长度
+ * @param time 耗时 单位秒
  * @return void
- * @note 解析成功时会更新stats
+ * @note 表满时新出现的系统调用会被忽略
  */
-void parse_strace_line(const char *line, syscall_stats *stats)
+void stat_record(syscall_stats *stats, const char *name, size_t len, double time)
 {
-    regmatch_t name_matches[MAX_MATCHES], time_matches[MAX_MATCHES];
-    char name[64] = {0};
-    double time = 0.0;
-
-    // 提取系统调用名称
-    if (regexec(&name_regex, line, MAX_MATCHES, name_matches, 0) != 0)
+    syscall_stat *st = stat_lookup(stats, name, len);
+    if (st == NULL)
         return;
-    size_t len = name_matches[1].rm_eo - name_matches[1].rm_so;
-    if (len >= sizeof(name))
-        return;
-    strncpy(name, line + name_matches[1].rm_so, len);
-    name[len] = '\0';
 
-    // 提取时间
-    if (regexec(&time_regex, line, MAX_MATCHES, time_matches, 0) != 0)
-        return;
-    len = time_matches[1].rm_eo - time_matches[1].rm_so;
-    char time_str[16] = {0};
-    if (len >= sizeof(time_str))
-        return;
-    strncpy(time_str, line + time_matches[1].rm_so, len);
-    time = atof(time_str);
+    st->total_time += time;
+    st->count++;
+    st->hist[hist_bucket(time)]++;
+    stats->total_time += time;
+}
 
-    // 合并系统调用
-    for (int i = 0; i < stats->count; i++)
+/**
+ * @brief 把 src 中的统计合并进 dst
+ * @param dst 合并目标
+ * @param src 合并来源
+ * @return void
+ * @note 用于合并各个解析线程的结果
+ */
+void stats_merge(syscall_stats *dst, const syscall_stats *src)
+{
+    for (int i = 0; i < src->count; i++)
     {
-        if (strcmp(stats->stats[i].name, name) == 0)
-        {
-            stats->stats[i].total_time += time;
-            stats->stats[i].count++;
-            stats->total_time += time;
-            return;
-        }
+        const syscall_stat *s = &src->stats[i];
+        syscall_stat *d = stat_lookup(dst, s->name, strlen(s->name));
+        if (d == NULL)
+            continue;
+        d->total_time += s->total_time;
+        d->count += s->count;
+        for (int b = 0; b < HIST_BUCKETS; b++)
+            d->hist[b] += s->hist[b];
+        dst->total_time += s->total_time;
     }
+}
 
-    // 新增系统调用
-    if (stats->count < MAX_SYSCALLS)
-    {
-        strcpy(stats->stats[stats->count].name, name);
-        stats->stats[stats->count].total_time = time;
-        stats->stats[stats->count].count = 1;
-        stats->total_time += time;
-        stats->count++;
-    }
+static inline int is_name_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_';
 }
 
-int cmp(const void *a, const void *b)
+static inline int is_digit(char c)
 {
-    const syscall_stat *stat1 = (const syscall_stat *)a;
-    const syscall_stat *stat2 = (const syscall_stat *)b;
-    return stat1->total_time < stat2->total_time;
+    return c >= '0' && c <= '9';
 }
 
 /**
- * @brief 打印系统调用统计信息
- * @param stats 系统调用统计信息
+ * @brief 初始化文件描述符统计
+ * @param fds 文件描述符统计
  * @return void
- * @note 按时间排序并输出前TOP_N个系统调用的统计信息
+ * @note 第一项固定为 "[other]" 名字表满后的路径都记到这里
  */
-void print_top_syscalls(syscall_stats *stats)
+void fd_tracker_init(fd_tracker *fds)
 {
-    // 如果没有数据 不输出
-    if (stats->total_time == 0)
-        return;
-
-    // 按耗时排序
-    qsort(stats->stats, stats->count, sizeof(syscall_stat), cmp);
+    memset(fds, 0, sizeof(*fds));
+    stat_lookup(&fds->stats, FD_OTHER, strlen(FD_OTHER));
+}
 
-    // 清屏
-    int rtc = system("clear"); // Linux/Unix 系统
+/**
+ * @brief 清空 fd 绑定和未完成的调用 保留已有的统计
+ * @param fds 文件描述符统计
+ * @return void
+ * @note 离线解析每个分块开始时调用 上一个分块或文件中的 fd 与这里无关
+ */
+void fd_tracker_reset(fd_tracker *fds)
+{
+    memset(fds->bind, 0, sizeof(fds->bind));
+    memset(fds->pending, 0, sizeof(fds->pending));
+    fds->bind_count = 0;
+}
 
-    // 检查命令是否成功执行
-    if (rtc != 0)
+/**
+ * @brief 查找 (pid, fd) 的绑定
+ * @param fds 文件描述符统计
+ * @param pid 行首的 pid 没有前缀时为0
+ * @param fd 文件描述符
+ * @return 绑定所在的槽 或者应当插入的空槽
+ * @note 线性探测 表不会填满 总能停在空槽上
+ */
+static fd_binding *fd_binding_slot(fd_tracker *fds, int pid, int fd)
+{
+    unsigned h = ((unsigned)pid * 2654435761u) ^ ((unsigned)fd * 40503u);
+    for (unsigned i = h;; i++)
     {
-        fprintf(stderr, "Failed to clear the screen\n");
+        fd_binding *b = &fds->bind[i & (FD_BINDINGS - 1)];
+        if (b->key == 0 || (b->key == pid + 1 && b->fd == fd))
+            return b;
     }
+}
 
-    printf("Time: %.2lfs\n", cnt);
-    // 输出前TOP_N个
-    for (int i = 0; i < TOP_N && i < stats->count; i++)
+/**
+ * @brief 把路径驻留到文件描述符统计表中
+ * @param fds 文件描述符统计
+ * @param path 路径 不要求以\0结尾
+ * @param len 路径长度
+ * @return 统计项下标
+ * @note 名字与统计项共用同一张表和索引 表满时返回 "[other]"
+ *       过长的路径保留末尾部分
+ */
+int fd_intern(fd_tracker *fds, const char *path, size_t len)
+{
+    size_t max = sizeof(fds->stats.stats[0].name) - 1;
+    if (len > max)
     {
-        int ratio = (int)((stats->stats[i].total_time / stats->total_time) * 100);
-        printf("%s (%d%%)\n", stats->stats[i].name, ratio);
+        path += len - max;
+        len = max;
     }
-    printf("=====================\n");
-    cnt += 0.1;
-
-    // 输出80个\0分隔符并刷新缓冲区
-    for (int i = 0; i < 80; i++)
-        putchar('\0');
-
-    fflush(stdout);
+    syscall_stat *st = stat_lookup(&fds->stats, path, len);
+    return st ? (int)(st - fds->stats.stats) : 0;
 }
 
 /**
- * @brief 定时器信号处理函数
- * @param signum 信号编号
+ * @brief 记录一次 I/O 系统调用在文件描述符上的耗时
+ * @param fds 文件描述符统计
+ * @param pid 发起调用的进程 没有前缀时为0
+ * @param fd 文件描述符
+ * @param slot 已知的统计项下标 -1 表示按 fd 表查找
+ * @param time 耗时 单位秒
  * @return void
- * @note 打印系统调用统计信息并刷新缓冲区
+ * @note 该进程的 fd 表中没有记录时归到 "fd N"
  */
-void signal_handler(int signum)
+void fd_record(fd_tracker *fds, int pid, int fd, int slot, double time)
 {
-    print_top_syscalls(&stats);
+    if (slot < 0 && fd >= 0)
+    {
+        fd_binding *b = fd_binding_slot(fds, pid, fd);
+        if (b->key != 0)
+            slot = b->slot;
+    }
+    if (slot < 0)
+    {
+        char name[32];
+        slot = fd_intern(fds, name, snprintf(name, sizeof(name), "fd %d", fd));
+    }
+
+    syscall_stat *st = &fds->stats.stats[slot];
+    st->total_time += time;
+    st->count++;
+    st->hist[hist_bucket(time)]++;
+    fds->stats.total_time += time;
 }
 
 /**
- * @brief 设置定时器
- * @param void
+ * @brief 记住某个进程的 fd 对应的路径
+ * @param fds 文件描述符统计
+ * @param pid 进程 没有前缀时为0
+ * @param fd 文件描述符
+ * @param slot 路径的统计项下标 -1 表示 fd 已关闭
  * @return void
- * @note 设定定时器信号处理函数并启动定时器
+ * @note 关闭只把槽标为未知 不腾出 表用到四分之三后新的 fd 按 "fd N" 统计
  */
-void setup_timer(void)
+void fd_bind(fd_tracker *fds, int pid, int fd, int slot)
 {
-    struct itimerval itv;
-    itv.it_interval.tv_sec = INTERVAL_MS / 1000;           // 秒部分
-    itv.it_interval.tv_usec = (INTERVAL_MS % 1000) * 1000; // 微秒部分（100ms=100000us）
-    itv.it_value = itv.it_interval;                        // 首次触发间隔与重复间隔相同
-
-    struct sigaction sa;
-    sa.sa_handler = signal_handler; // 设置信号处理函数
-    sigemptyset(&sa.sa_mask);       // 清空信号掩码
-    sa.sa_flags = 0;
+    if (fd < 0)
+        return;
+    fd_binding *b = fd_binding_slot(fds, pid, fd);
+    if (b->key == 0)
+    {
+        if (slot < 0 || fds->bind_count >= FD_BINDINGS / 4 * 3)
+            return;
+        *b = (fd_binding){.key = pid + 1, .fd = fd};
+        fds->bind_count++;
+    }
+    b->slot = slot;
+}
 
-    if (sigaction(SIGALRM, &sa, NULL) == -1 ||
-        setitimer(ITIMER_REAL, &itv, NULL) == -1)
+/**
+ * @brief 是否为按 fd 统计的 I/O 系统调用
+ * @param name 系统调用名称 不要求以\0结尾
+ * @param len 名称长度
+ * @return 1 是 0 否
+ * @note 这些调用的第一个参数都是 fd
+ */
+int is_fd_syscall(const char *name, size_t len)
+{
+    static const char *const io_syscalls[] = {
+        "read", "write", "pread64", "pwrite64", "readv", "writev",
+        "preadv", "pwritev", "sendto", "recvfrom", "sendmsg", "recvmsg",
+        "fsync", "fdatasync", NULL,
+    };
+    for (int i = 0; io_syscalls[i]; i++)
     {
-        perror("Timer setup failed");
-        exit(1);
+        if (strlen(io_syscalls[i]) == len && memcmp(io_syscalls[i], name, len) == 0)
+            return 1;
     }
+    return 0;
 }
 
-int main(int argc, char *argv[])
+/**
+ * @brief 解析第一个参数 fd 以及 -y 附带的路径
+ * @param fds 文件描述符统计
+ * @param args 左括号之后的参数部分
+ * @param end 参数部分的结尾
+ * @param slot 路径的统计项下标 没有路径时为-1
+ * @return fd 第一个参数不是数字时返回-1
+ * @note none
+ */
+static int fd_first_arg(fd_tracker *fds, const char *args, const char *end, int *slot)
 {
-    // 命令行参数检查
-    if (argc < 2)
+    int fd = -1;
+    *slot = -1;
+    const char *a = args;
+    if (a < end && is_digit(*a))
     {
-        fprintf(stderr, "Usage: %s <command> [args...]\n", argv[0]);
-        return 1;
+        fd = 0;
+        while (a < end && is_digit(*a))
+            fd = fd * 10 + (*a++ - '0');
+        if (a < end && *a == '<')
+        {
+            const char *path = a + 1;
+            const char *close_br = path;
+            while (close_br < end && !(*close_br == '>' && close_br + 1 < end &&
+                                       (close_br[1] == ',' || close_br[1] == ')')))
+                close_br++;
+            if (close_br < end)
+                *slot = fd_intern(fds, path, close_br - path);
+        }
     }
+    return fd;
+}
+
+/**
+ * @brief 暂存或取出 pid 上未完成的 I/O 调用的 fd
+ * @param fds 文件描述符统计
+ * @param pid 行首的 pid 没有前缀时为0
+ * @return 该 pid 的槽
+ * @note 槽按 pid 哈希 冲突时新的调用覆盖旧的 旧调用的续行归入 FD_UNKNOWN
+ */
+static fd_pending *fd_pending_slot(fd_tracker *fds, int pid)
+{
+    return &fds->pending[((unsigned)pid * 2654435761u >> 8) & (FD_PENDING - 1)];
+}
 
-    // 初始化正则表达式
-    if (regex_init() != 0)
+/**
+ * @brief 按 fd 统计一行strace输出
+ * @param fds 文件描述符统计
+ * @param pid 行首的 pid 没有前缀时为0
+ * @param name 系统调用名称
+ * @param name_len 名称长度
+ * @param args 左括号之后的参数部分 续行为 "resumed>" 之后的部分
+ * @param end 行尾（耗时之前）
+ * @param resumed 是否为 <... NAME resumed> 续行
+ * @param time 耗时 单位秒
+ * @return void
+ * @note strace -y 打印的 "3</path>" 直接给出路径
+ *       否则由 open/openat/creat/socket 的返回值建立该 pid 的 fd 表 close 时清除
+ *       续行没有第一个参数 fd 取自同一 pid 的 <unfinished ...> 行
+ *       找不到时（如两行分在不同的解析分块）归入 FD_UNKNOWN
+ *       open 等调用的续行不再建立 fd 表 之后的 I/O 按 "fd N" 统计
+ */
+static void fd_parse(fd_tracker *fds, int pid, const char *name, size_t name_len,
+                     const char *args, const char *end, int resumed, double time)
+{
+    if (resumed)
     {
-        return 1;
+        if (!is_fd_syscall(name, name_len))
+            return;
+        fd_pending *pending = fd_pending_slot(fds, pid);
+        if (pending->key == pid + 1)
+        {
+            pending->key = 0;
+            fd_record(fds, pid, pending->fd, pending->slot, time);
+        }
+        else
+            fd_record(fds, pid, -1, fd_intern(fds, FD_UNKNOWN, strlen(FD_UNKNOWN)), time);
+        return;
     }
 
-    // 初始化系统调用统计信息
-    memset(&stats, 0, sizeof(stats));
+    int slot;
+    int fd = fd_first_arg(fds, args, end, &slot);
+    if (is_fd_syscall(name, name_len))
+    {
+        if (fd >= 0)
+            fd_record(fds, pid, fd, slot, time);
+        return;
+    }
 
-    // 创建管道
-    int pipefd[2];
-    if (pipe(pipefd) == -1)
+    // 返回值 位于最后一个 " = " 之后
+    const char *eq = NULL;
+    for (const char *r = end - 3; r >= args; r--)
     {
-        perror("pipe");
-        return 1;
+        if (r[0] == ' ' && r[1] == '=' && r[2] == ' ')
+        {
+            eq = r + 3;
+            break;
+        }
     }
 
-    // fork() 系统调用
-    pid_t pid = fork();
-    if (pid < 0)
+    if (name_len == 5 && memcmp(name, "close", 5) == 0)
     {
-        perror("fork");
-        return 1;
+        fd_bind(fds, pid, fd, -1);
+        return;
     }
+    if (eq == NULL || !is_digit(*eq))
+        return;
+    int ret = atoi(eq);
 
-    // 子进程：运行strace并重定向输出（同原实现，增强路径兼容性）
-    if (pid == 0)
+    if ((name_len == 4 && memcmp(name, "open", 4) == 0) ||
+        (name_len == 6 && memcmp(name, "openat", 6) == 0) ||
+        (name_len == 7 && memcmp(name, "openat2", 7) == 0) ||
+        (name_len == 5 && memcmp(name, "creat", 5) == 0))
     {
-        close(pipefd[0]);               // 关闭管道读端
-        dup2(pipefd[1], STDOUT_FILENO); // 标准输出重定向到管道写端
-        dup2(pipefd[1], STDERR_FILENO); // 标准错误重定向到管道写端
-        close(pipefd[1]);               // 关闭管道写端
+        // 路径是第一个带引号的参数 strace 会把其中的引号转义为 \"
+        const char *q1 = memchr(args, '"', end - args);
+        const char *q2 = q1 ? q1 + 1 : end;
+        while (q2 < end && *q2 != '"')
+            q2 += *q2 == '\\' ? 2 : 1;
+        if (q2 < end)
+            fd_bind(fds, pid, ret, fd_intern(fds, q1 + 1, q2 - q1 - 1));
+    }
+    else if ((name_len == 6 && memcmp(name, "socket", 6) == 0) ||
+             (name_len == 6 && memcmp(name, "accept", 6) == 0) ||
+             (name_len == 7 && memcmp(name, "accept4", 7) == 0))
+    {
+        fd_bind(fds, pid, ret, fd_intern(fds, "socket", 6));
+    }
+}
 
-        // 自动搜索strace路径
-        char *strace_paths[] = {"/usr/bin/strace", "/bin/strace", NULL};
+/**
+ * @brief 解析一行strace输出
+ * @param line 待解析的strace输出行 不要求以\0结尾
+ * @param len 行长度
+ * @param stats 系统调用统计信息
+ * @param fds 文件描述符统计 NULL 表示不按 fd 统计
+ * @return void
+ * @note 解析成功时会更新stats
+ *       支持 -f 的 "PID " / "[pid PID] " 前缀、-t/-tt/-ttt 时间戳
+ *       以及 "<... NAME resumed>" 续行；<unfinished ...> 行没有耗时
+ *       只在按 fd 统计时为续行记下 I/O 调用的 fd
+ *       手写的扫描器 不用正则 多线程解析时也无需共享状态
+ */
+void parse_strace_record(const char *line, size_t len, syscall_stats *stats,
+                         fd_tracker *fds)
+{
+    const char *p = line;
+    const char *end = line + len;
 
-        // 命令行参数转变为 execve 的参数...
-        char **exec_argv = malloc((argc + 2) * sizeof(char *));
-        exec_argv[0] = "strace";
-        exec_argv[1] = "-T";
-        for (int i = 1; i < argc; i++)
-        {
-            exec_argv[i + 1] = argv[i];
-        }
-        exec_argv[argc + 1] = NULL;
+    // 去掉行尾空白
+    while (end > p && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' '))
+        end--;
 
-        // 寻找 strace 命令路径
-        char *exec_envp[] = {"PATH=/bin:/usr/bin", NULL};
-        int found = 0;
-        for (int i = 0; strace_paths[i]; i++)
+    // 跳过 "[pid 123] " 前缀
+    int pid = 0;
+    if (end - p > 4 && memcmp(p, "[pid", 4) == 0)
+    {
+        const char *q = memchr(p, ']', end - p);
+        if (q == NULL)
+            return;
+        for (p += 4; p < q; p++)
         {
-            if (execve(strace_paths[i], exec_argv, exec_envp) == 0)
-            {
-                found = 1;
-                break;
-            }
+            if (is_digit(*p) && pid < 100000000)
+                pid = pid * 10 + (*p - '0');
         }
-        if (!found)
+        p = q + 1;
+        while (p < end && *p == ' ')
+            p++;
+    }
+
+    // 跳过 "123 " 形式的 pid 和时间戳 时间戳中总有 '.' 或 ':'
+    // 只累加前 9 位纯数字 -ttt 的整秒部分之类的长数字不会溢出
+    for (int k = 0; k < 2; k++)
+    {
+        const char *q = p;
+        int value = 0, plain = 1;
+        for (; q < end && (is_digit(*q) || *q == '.' || *q == ':'); q++)
         {
-            perror("execve strace");
-            free(exec_argv);
-            return 1;
+            plain &= is_digit(*q) && q - p < 9;
+            if (plain)
+                value = value * 10 + (*q - '0');
         }
-        free(exec_argv);
-        return 0;
+        if (q == p || q >= end || *q != ' ')
+            break;
+        if (k == 0 && plain)
+            pid = value;
+        p = q;
+        while (p < end && *p == ' ')
+            p++;
     }
 
-    // 父进程：设置定时器并读取管道数据
-    close(pipefd[1]);
-    setup_timer();
-
-    char buffer[8192]; // 增大缓冲区减少read次数
-    while (1)
+    // 提取系统调用名称
+    const char *name = p;
+    const char *q;
+    int resumed = end - p > 5 && memcmp(p, "<... ", 5) == 0;
+    if (resumed)
     {
-        // 读取管道数据
-        ssize_t n = read(pipefd[0], buffer, sizeof(buffer));
-        if (n <= 0)
-            break;
+        name = p + 5;
+        for (q = name; q < end && is_name_char(*q); q++)
+            ;
+        if (q >= end || *q != ' ')
+            return;
+    }
+    else
+    {
+        for (q = name; q < end && is_name_char(*q); q++)
+            ;
+        if (q >= end || *q != '(')
+            return;
+    }
+    size_t name_len = q - name;
 
-        // 手动分割行
-        char *start = buffer;
-        char *end = buffer;
-        while (end < buffer + n)
-        {
-            if (*end == '\n')
-            {
-                *end = '\0';
-                // 解析数据 更新 stats 表
-                parse_strace_line(start, &stats);
-                start = end + 1;
-            }
-            end++;
-        }
-        // 处理最后一行（无换行符）
-        if (start < buffer + n)
+    // 未完成的 I/O 调用 记下 fd 等续行给出耗时
+    static const char unfinished[] = "<unfinished ...>";
+    size_t unfinished_len = sizeof(unfinished) - 1;
+    if (end - q > (ptrdiff_t)unfinished_len &&
+        memcmp(end - unfinished_len, unfinished, unfinished_len) == 0)
+    {
+        if (fds != NULL && !resumed && is_fd_syscall(name, name_len))
         {
-            parse_strace_line(start, &stats);
+            fd_pending *pending = fd_pending_slot(fds, pid);
+            pending->fd = fd_first_arg(fds, q + 1, end - unfinished_len, &pending->slot);
+            pending->key = pending->fd >= 0 ? pid + 1 : 0;
         }
+        return;
+    }
+
+    // 提取时间 位于行尾的 <0.000123>
+    if (end - q < 3 || end[-1] != '>')
+        return;
+    const char *t = end - 1;
+    while (t > q && (is_digit(t[-1]) || t[-1] == '.'))
+        t--;
+    if (t == end - 1 || t[-1] != '<')
+        return;
+
+    double time = 0, scale = 0;
+    for (; t < end - 1; t++)
+    {
+        if (*t == '.')
+            scale = 1;
+        else if (scale == 0)
+            time = time * 10 + (*t - '0');
+        else
+            time += (*t - '0') * (scale /= 10);
     }
+    time = corrected_time(time);
+
+    stat_record(stats, name, name_len, time);
+    if (fds != NULL)
+        fd_parse(fds, pid, name, name_len, q + 1, t - 1, resumed, time);
+}
+
+/**
+ * @brief 解析以\0结尾的strace输出行
+ * @param line 待解析的strace输出行
+ * @param stats 系统调用统计信息 全局变量
+ * @param fds 文件描述符统计 NULL 表示不按 fd 统计
+ * @return void
+ * @note 解析成功时会更新stats
+ */
+void parse_strace_line(const char *line, syscall_stats *stats, fd_tracker *fds)
+{
+    parse_strace_record(line, strlen(line), stats, fds);
+}
 
-    close(pipefd[0]);           // 关闭管道读端
-    wait(NULL);                 // 等待子进程结束
-    print_top_syscalls(&stats); // 打印信息
-    regex_cleanup();            // 释放正则资源
+int cmp(const void *a, const void *b)
+{
+    const syscall_stat *stat1 = (const syscall_stat *)a;
+    const syscall_stat *stat2 = (const syscall_stat *)b;
+    // 按耗时降序
+    if (stat1->total_time < stat2->total_time)
+        return 1;
+    if (stat1->total_time > stat2->total_time)
+        return -1;
     return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief 距离跟踪开始经过的秒数
+ * @param void
+ * @return 经过的秒数
+ * @note 使用 CLOCK_MONOTONIC 不受系统时间调整影响
+ */
+double elapsed_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start_time.tv_sec) +
+           (now.tv_nsec - start_time.tv_nsec) / 1e9;
+}
+
+/**
+ * @brief 把快照中耗时最多的前TOP_N项格式化到报告中
+ * @param report 报告缓冲区
+ * @param off 已写入的长度
+ * @param size 缓冲区大小
+ * @param snap 已按耗时排序的快照
+ * @param live 未排序的原表 非NULL且采集了调用栈时 每项下面列出最耗时的调用者
+ * @return 新的已写入长度
+ * @note 没有调用次数的项（只驻留了名字）不输出
+ */
+static size_t format_top(char *report, size_t off, size_t size,
+                         const syscall_stats *snap, const syscall_stats *live)
+{
+    for (int i = 0, shown = 0; shown < TOP_N && i < snap->count && off < size; i++)
+    {
+        const syscall_stat *st = &snap->stats[i];
+        if (st->count == 0)
+            continue;
+        int ratio = (int)((st->total_time / snap->total_time) * 100);
+        off += snprintf(report + off, size - off, "%s (%d%%)\n", st->name, ratio);
+        shown++;
+
+        int stat = live != NULL && stack_nodes != NULL ? stat_find(live, st->name, strlen(st->name)) : -1;
+        if (stat >= 0 && off < size)
+            off = stack_format_callers(report, off, size, stat, st->total_time);
+    }
+    return off < size ? off : size - 1;
+}
+
+/**
+ * @brief 打印系统调用统计信息
+ * @param stats 系统调用统计信息
+ * @param fd_stats 按文件描述符的统计 NULL 表示不输出
+ * @return void
+ * @note 先拷贝一份快照再排序 不修改 stats 本身
+ *       整个报告先格式化到缓冲区 再一次性写出
+ *       用 ANSI 转义序列清屏 不再 fork 出 clear 命令
+ */
+void print_top_syscalls(const syscall_stats *stats, const syscall_stats *fd_stats)
+{
+    // 如果没有数据 不输出
+    if (stats->total_time == 0)
+        return;
+
+    // 拷贝快照 按耗时排序
+    memcpy(&snapshot, stats, sizeof(snapshot));
+    qsort(snapshot.stats, snapshot.count, sizeof(syscall_stat), cmp);
+
+    char report[REPORT_SIZE];
+    size_t off = 0;
+
+    // 清屏：光标移到左上角 并清除到屏幕末尾
+    off += snprintf(report + off, sizeof(report) - off, "\033[H\033[J");
+    off += snprintf(report + off, sizeof(report) - off,
+                    "Time: %.2lfs\n", elapsed_seconds());
+
+    // 输出前TOP_N个
+    off = format_top(report, off, sizeof(report), &snapshot, stats);
+    off += snprintf(report + off, sizeof(report) - off,
+                    "=====================\n");
+
+    // 最耗时的文件描述符
+    if (fd_stats != NULL && fd_stats->total_time > 0)
+    {
+        memcpy(&fd_snapshot, fd_stats, sizeof(fd_snapshot));
+        qsort(fd_snapshot.stats, fd_snapshot.count, sizeof(syscall_stat), cmp);
+        off = format_top(report, off, sizeof(report), &fd_snapshot, NULL);
+        off += snprintf(report + off, sizeof(report) - off,
+                        "=====================\n");
+    }
+
+    // 输出80个\0分隔符
+    if (off + 80 > sizeof(report))
+        off = sizeof(report) - 80;
+    memset(report + off, '\0', 80);
+    off += 80;
+
+    fwrite(report, 1, off, stdout);
+    fflush(stdout);
+}
+
+/**
+ * @brief 由直方图估算耗时分位数
+ * @param hist 耗时直方图
+ * @param count 直方图中的样本总数
+ * @param p 分位点 取值 0~1
+ * @return 分位数 单位秒
+ * @note 在命中的桶内按线性插值 误差不超过一个桶宽
+ */
+double stat_percentile(const uint64_t *hist, unsigned long count, double p)
+{
+    if (count == 0)
+        return 0;
+
+    double rank = p * count;
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++)
+    {
+        if (hist[b] == 0)
+            continue;
+        if (seen + hist[b] >= rank)
+        {
+            double lo = b == 0 ? 0 : ldexp(1, b - 1);
+            double hi = ldexp(1, b);
+            double frac = (rank - seen) / hist[b];
+            return (lo + (hi - lo) * frac) / 1e9;
+        }
+        seen += hist[b];
+    }
+    return ldexp(1, HIST_BUCKETS - 1) / 1e9;
+}
+
+/**
+ * @brief 打开流式输出
+ * @param out 输出流
+ * @param path 输出文件路径 "-" 表示标准输出 NULL 表示使用 fd
+ * @param fd 已打开的文件描述符 path 为 NULL 时使用
+ * @param format 输出格式
+ * @return 0 on success, -1 on failure
+ * @note 不改 fd 的文件状态标志 标准输出与父进程共用 改成非阻塞会影响 shell
+ *       写之前用 poll 检查可写 管道每次最多写 PIPE_BUF 字节 不会阻塞
+ *       消费方处理不过来时数据留在缓冲区 不会卡住解析
+ */
+int output_open(output_stream *out, const char *path, int fd, output_format format)
+{
+    memset(out, 0, sizeof(*out));
+    out->format = format;
+    out->fd = fd;
+
+    if (path != NULL && strcmp(path, "-") == 0)
+    {
+        out->fd = STDOUT_FILENO;
+    }
+    else if (path != NULL)
+    {
+        out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out->fd == -1)
+        {
+            perror(path);
+            return -1;
+        }
+    }
+
+    struct stat st;
+    if (fstat(out->fd, &st) == -1)
+    {
+        perror("fstat");
+        return -1;
+    }
+    out->write_max = S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode) ? PIPE_BUF : OUT_BUFFER_SIZE;
+
+    out->buf = malloc(OUT_BUFFER_SIZE);
+    if (out->buf == NULL)
+    {
+        perror("malloc");
+        return -1;
+    }
+
+    if (format == FORMAT_BINARY)
+    {
+        sperf_stream_header hdr = {.version = SPERF_VERSION, .byte_order = 0x0102};
+        memcpy(hdr.magic, SPERF_MAGIC, sizeof(hdr.magic));
+        memcpy(out->buf, &hdr, sizeof(hdr));
+        out->len = sizeof(hdr);
+    }
+    return 0;
+}
+
+/**
+ * @brief 把字符串转义为 JSON 字符串内容
+ * @param dst 转义结果
+ * @param size dst 大小 至少为 6 倍源串长度加一
+ * @param src 源字符串
+ * @return void
+ * @note 路径中可能出现引号、反斜杠和控制字符
+ */
+static void json_escape(char *dst, size_t size, const char *src)
+{
+    size_t n = 0;
+    for (; *src && n + 7 < size; src++)
+    {
+        unsigned char c = *src;
+        if (c == '"' || c == '\\')
+        {
+            dst[n++] = '\\';
+            dst[n++] = c;
+        }
+        else if (c < 0x20)
+            n += snprintf(dst + n, size - n, "\\u%04x", c);
+        else
+            dst[n++] = c;
+    }
+    dst[n] = '\0';
+}
+
+/**
+ * @brief 输出一个区间内的增量统计
+ * @param out 输出流
+ * @param cur 当前的累计统计
+ * @param prev 上一次输出时的累计统计 输出后更新为 cur
+ * @param ts 区间结束时刻 相对跟踪开始 单位秒
+ * @param kind SPERF_KIND_SYSCALL 或 SPERF_KIND_FD
+ * @return void
+ * @note stats 表只追加不重排 下标相同即同一种系统调用
+ *       缓冲区放不下整个区间时丢弃该区间 不阻塞等待
+ */
+void output_interval(output_stream *out, const syscall_stats *cur,
+                     syscall_stats *prev, double ts, int kind)
+{
+    size_t start = out->len;
+
+    for (int i = 0; i < cur->count; i++)
+    {
+        const syscall_stat *c = &cur->stats[i];
+        const syscall_stat *p = i < prev->count ? &prev->stats[i] : NULL;
+
+        unsigned long count = c->count - (p ? p->count : 0);
+        if (count == 0)
+            continue;
+
+        double total = c->total_time - (p ? p->total_time : 0);
+        uint64_t hist[HIST_BUCKETS];
+        for (int b = 0; b < HIST_BUCKETS; b++)
+            hist[b] = c->hist[b] - (p ? p->hist[b] : 0);
+        double p50 = stat_percentile(hist, count, 0.50);
+        double p90 = stat_percentile(hist, count, 0.90);
+        double p99 = stat_percentile(hist, count, 0.99);
+
+        size_t room = OUT_BUFFER_SIZE - out->len;
+        size_t need;
+        if (out->format == FORMAT_JSON)
+        {
+            char name[sizeof(c->name) * 6];
+            json_escape(name, sizeof(name), c->name);
+            // 直方图只列非空的桶 供 --diff 做显著性检验
+            char hist_json[HIST_BUCKETS * 24];
+            size_t h = 0;
+            for (int b = 0; b < HIST_BUCKETS; b++)
+            {
+                if (hist[b] != 0)
+                    h += snprintf(hist_json + h, sizeof(hist_json) - h, "%s\"%d\":%llu",
+                                  h == 0 ? "" : ",", b, (unsigned long long)hist[b]);
+            }
+            hist_json[h] = '\0';
+            need = snprintf(out->buf + out->len, room,
+                            "{\"ts\":%.6f,\"%s\":\"%s\",\"count\":%lu,"
+                            "\"total_time\":%.9f,\"p50\":%.9f,\"p90\":%.9f,\"p99\":%.9f,"
+                            "\"hist\":{%s}}\n",
+                            ts, kind == SPERF_KIND_FD ? "fd" : "syscall", name,
+                            count, total, p50, p90, p99, hist_json);
+        }
+        else
+        {
+            size_t name_len = strlen(c->name);
+            sperf_hist_entry entries[HIST_BUCKETS];
+            int hist_len = 0;
+            for (int b = 0; b < HIST_BUCKETS; b++)
+            {
+                if (hist[b] != 0)
+                    entries[hist_len++] = (sperf_hist_entry){.bucket = (uint8_t)b, .count = (uint32_t)hist[b]};
+            }
+            sperf_record rec = {
+                .ts_ns = (uint64_t)(ts * 1e9),
+                .total_ns = (uint64_t)(total * 1e9),
+                .p50_ns = (uint64_t)(p50 * 1e9),
+                .p90_ns = (uint64_t)(p90 * 1e9),
+                .p99_ns = (uint64_t)(p99 * 1e9),
+                .count = (uint32_t)count,
+                .kind = (uint8_t)kind,
+                .name_len = (uint8_t)name_len,
+                .hist_len = (uint8_t)hist_len,
+            };
+            need = sizeof(rec) + name_len + hist_len * sizeof(sperf_hist_entry);
+            if (need <= room)
+            {
+                char *w = out->buf + out->len;
+                memcpy(w, &rec, sizeof(rec));
+                memcpy(w + sizeof(rec), c->name, name_len);
+                memcpy(w + sizeof(rec) + name_len, entries, hist_len * sizeof(sperf_hist_entry));
+            }
+        }
+
+        if (need > room)
+        {
+            // 消费方太慢 丢弃整个区间 保证记录完整
+            out->len = start;
+            out->dropped++;
+            break;
+        }
+        out->len += need;
+    }
+
+    memcpy(prev, cur, sizeof(*prev));
+}
+
+/**
+ * @brief 把缓冲区中的数据尽量写出
+ * @param out 输出流
+ * @return 0 on success, -1 on failure
+ * @note 写不完的部分留在缓冲区 等 fd 可写时再写
+ *       poll 报告可写时管道至少有 PIPE_BUF 字节空间 每次只写这么多
+ */
+int output_flush(output_stream *out)
+{
+    size_t done = 0;
+    while (done < out->len)
+    {
+        struct pollfd pfd = {.fd = out->fd, .events = POLLOUT};
+        if (poll(&pfd, 1, 0) != 1 || !(pfd.revents & (POLLOUT | POLLERR)))
+            break;
+        size_t chunk = out->len - done;
+        if (chunk > out->write_max)
+            chunk = out->write_max;
+        ssize_t n = write(out->fd, out->buf + done, chunk);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            perror("write");
+            out->len = 0;
+            return -1;
+        }
+        done += n;
+    }
+    memmove(out->buf, out->buf + done, out->len - done);
+    out->len -= done;
+    return 0;
+}
+
+/**
+ * @brief 写出剩余数据并关闭输出流
+ * @param out 输出流
+ * @return void
+ * @note 结束时等待 fd 可写 确保数据全部写出
+ */
+void output_close(output_stream *out)
+{
+    while (out->len > 0)
+    {
+        struct pollfd pfd = {.fd = out->fd, .events = POLLOUT};
+        if (poll(&pfd, 1, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (!(pfd.revents & (POLLOUT | POLLERR)) || output_flush(out) != 0)
+            break;
+    }
+
+    if (out->dropped > 0)
+        fprintf(stderr, "sperf: output too slow, dropped %lu intervals\n", out->dropped);
+    if (out->fd != STDOUT_FILENO)
+        close(out->fd);
+    free(out->buf);
+}
+
+/**
+ * @brief 设置定时器
+ * @param void
+ * @return timerfd 文件描述符 失败时返回-1
+ * @note 定时器到期不再产生信号 而是让 timerfd 可读
+ *       由主循环的 poll 统一处理 报告不会打断解析
+ */
+int setup_timer(void)
+{
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (tfd == -1)
+    {
+        perror("timerfd_create");
+        return -1;
+    }
+
+    struct itimerspec its;
+    its.it_interval.tv_sec = INTERVAL_MS / 1000;              // 秒部分
+    its.it_interval.tv_nsec = (INTERVAL_MS % 1000) * 1000000; // 纳秒部分
+    its.it_value = its.it_interval;                           // 首次触发间隔与重复间隔相同
+
+    if (timerfd_settime(tfd, 0, &its, NULL) == -1)
+    {
+        perror("timerfd_settime");
+        close(tfd);
+        return -1;
+    }
+    return tfd;
+}
+
+/**
+ * @brief 把一次 read() 得到的数据按行交给解析器
+ * @param lb 保存上次残留的不完整行
+ * @param data 新读到的数据
+ * @param n 数据长度
+ * @param stats 系统调用统计信息
+ * @param fds 文件描述符统计 NULL 表示不按 fd 统计
+ * @return void
+ * @note 不完整的行留在 lb 中 等下一次数据到达再拼接
+ *       超过 MAX_LINE 的行会被截断
+ */
+void feed_lines(line_buffer *lb, const char *data, size_t n, syscall_stats *stats,
+                fd_tracker *fds)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (data[i] == '\n')
+        {
+            lb->buf[lb->len] = '\0';
+            // 解析数据 更新 stats 表
+            parse_strace_line(lb->buf, stats, fds);
+            lb->len = 0;
+        }
+        else if (lb->len < sizeof(lb->buf) - 1)
+        {
+            lb->buf[lb->len++] = data[i];
+        }
+    }
+}
+
+// 离线解析的任务队列 线程通过原子计数领取分块
+typedef struct
+{
+    trace_chunk *chunks;
+    int count;
+    atomic_int next;
+} chunk_queue;
+
+// 每个解析线程私有的统计表 结束后由主线程合并
+typedef struct
+{
+    pthread_t tid;
+    chunk_queue *queue;
+    syscall_stats *stats;
+    fd_tracker *fds; // 按 fd 统计 未开启时为NULL
+} parse_worker;
+
+/**
+ * @brief 解析线程入口
+ * @param arg parse_worker
+ * @return NULL
+ * @note 只写线程私有的统计表 没有任何锁
+ */
+static void *parse_worker_main(void *arg)
+{
+    parse_worker *w = arg;
+    int i;
+    while ((i = atomic_fetch_add(&w->queue->next, 1)) < w->queue->count)
+    {
+        const char *p = w->queue->chunks[i].data;
+        const char *end = p + w->queue->chunks[i].len;
+        if (w->fds != NULL)
+            fd_tracker_reset(w->fds);
+        while (p < end)
+        {
+            const char *nl = memchr(p, '\n', end - p);
+            const char *eol = nl ? nl : end;
+            parse_strace_record(p, eol - p, w->stats, w->fds);
+            p = eol + 1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 收集一个 --input 参数对应的所有文件
+ * @param path 命令行给出的路径
+ * @param files 收集结果
+ * @param nfiles 已收集的文件数 会被更新
+ * @return 0 on success, -1 on failure
+ * @note 除 path 本身外 同目录下 path.PID 形式的文件（strace -ff 的输出）也会被收集
+ */
+static int collect_trace_files(const char *path, char **files, int *nfiles)
+{
+    int found = 0;
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && *nfiles < MAX_INPUTS)
+    {
+        files[(*nfiles)++] = strdup(path);
+        found = 1;
+    }
+
+    char *dir_copy = strdup(path);
+    char *base_copy = strdup(path);
+    const char *dir = dirname(dir_copy);
+    const char *base = basename(base_copy);
+    size_t base_len = strlen(base);
+
+    DIR *d = opendir(dir);
+    struct dirent *ent;
+    while (d != NULL && (ent = readdir(d)) != NULL && *nfiles < MAX_INPUTS)
+    {
+        // 形如 base.12345
+        const char *name = ent->d_name;
+        if (strncmp(name, base, base_len) != 0 || name[base_len] != '.')
+            continue;
+        const char *q = name + base_len + 1;
+        if (*q == '\0')
+            continue;
+        while (is_digit(*q))
+            q++;
+        if (*q != '\0')
+            continue;
+
+        char full[4096];
+        snprintf(full, sizeof(full), "%s/%s", dir, name);
+        files[(*nfiles)++] = strdup(full);
+        found = 1;
+    }
+    if (d != NULL)
+        closedir(d);
+    free(dir_copy);
+    free(base_copy);
+
+    if (!found)
+    {
+        fprintf(stderr, "%s: no such trace file\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 离线分析 strace -T 的输出文件
+ * @param paths --input 给出的路径
+ * @param npaths 路径个数
+ * @param out 合并后的统计信息
+ * @param fds 合并后的文件描述符统计 NULL 表示不按 fd 统计
+ * @return 0 on success, -1 on failure
+ * @note 文件整体 mmap 后在行边界处切成 CHUNK_SIZE 左右的分块
+ *       每个 CPU 一个线程解析到私有的统计表 最后合并
+ *       fd 表在每个分块开始时清空 open 与 I/O 不在同一分块时按 "fd N" 统计
+ *       用 strace -y 抓取的文件不受影响
+ */
+int analyze_trace_files(const char **paths, int npaths, syscall_stats *out, fd_tracker *fds)
+{
+    static char *files[MAX_INPUTS];
+    int nfiles = 0;
+    for (int i = 0; i < npaths; i++)
+    {
+        if (collect_trace_files(paths[i], files, &nfiles) != 0)
+            return -1;
+    }
+
+    // 映射所有文件并切分
+    void **maps = calloc(nfiles, sizeof(void *));
+    size_t *sizes = calloc(nfiles, sizeof(size_t));
+    chunk_queue queue = {.chunks = NULL, .count = 0};
+    int cap = 0;
+    int ret = 0;
+    size_t total_bytes = 0;
+
+    for (int f = 0; f < nfiles; f++)
+    {
+        int fd = open(files[f], O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1)
+        {
+            perror(files[f]);
+            if (fd != -1)
+                close(fd);
+            ret = -1;
+            break;
+        }
+        if (st.st_size == 0)
+        {
+            close(fd);
+            continue;
+        }
+        maps[f] = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (maps[f] == MAP_FAILED)
+        {
+            perror("mmap");
+            maps[f] = NULL;
+            ret = -1;
+            break;
+        }
+        sizes[f] = st.st_size;
+        total_bytes += st.st_size;
+        madvise(maps[f], st.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+        // 在 CHUNK_SIZE 附近的换行处切分
+        const char *data = maps[f];
+        size_t pos = 0;
+        while (pos < sizes[f])
+        {
+            size_t end = pos + CHUNK_SIZE;
+            if (end >= sizes[f])
+                end = sizes[f];
+            else
+            {
+                const char *nl = memchr(data + end, '\n', sizes[f] - end);
+                end = nl ? (size_t)(nl - data) + 1 : sizes[f];
+            }
+
+            if (queue.count == cap)
+            {
+                cap = cap ? cap * 2 : 64;
+                queue.chunks = realloc(queue.chunks, cap * sizeof(trace_chunk));
+            }
+            queue.chunks[queue.count++] = (trace_chunk){data + pos, end - pos};
+            pos = end;
+        }
+    }
+
+    if (ret == 0)
+    {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        int nthreads = ncpu > 0 ? (int)ncpu : 1;
+        if (nthreads > queue.count)
+            nthreads = queue.count > 0 ? queue.count : 1;
+        atomic_init(&queue.next, 0);
+
+        parse_worker *workers = calloc(nthreads, sizeof(parse_worker));
+        for (int i = 0; i < nthreads; i++)
+        {
+            workers[i].queue = &queue;
+            workers[i].stats = calloc(1, sizeof(syscall_stats));
+            if (fds != NULL)
+            {
+                workers[i].fds = malloc(sizeof(fd_tracker));
+                fd_tracker_init(workers[i].fds);
+            }
+        }
+        // 主线程自己也作为 0 号解析线程
+        for (int i = 1; i < nthreads; i++)
+        {
+            if (pthread_create(&workers[i].tid, NULL, parse_worker_main, &workers[i]) != 0)
+                workers[i].tid = 0;
+        }
+        parse_worker_main(&workers[0]);
+        for (int i = 0; i < nthreads; i++)
+        {
+            if (i > 0 && workers[i].tid != 0)
+                pthread_join(workers[i].tid, NULL);
+            stats_merge(out, workers[i].stats);
+            if (fds != NULL)
+                stats_merge(&fds->stats, &workers[i].fds->stats);
+            free(workers[i].stats);
+            free(workers[i].fds);
+        }
+        free(workers);
+
+        fprintf(stderr, "sperf: parsed %d file(s), %.1f MB with %d thread(s) in %.3fs\n",
+                nfiles, total_bytes / 1048576.0, nthreads, elapsed_seconds());
+    }
+
+    for (int f = 0; f < nfiles; f++)
+    {
+        if (maps[f] != NULL)
+            munmap(maps[f], sizes[f]);
+        free(files[f]);
+    }
+    free(maps);
+    free(sizes);
+    free(queue.chunks);
+    return ret;
+}
+
+// ======================== strace 管道后端 ========================
+
+static int strace_fd = -1;     // strace 输出管道的读端
+static pid_t strace_pid = -1;  // strace 进程
+static line_buffer strace_lb;  // 跨 read() 的残留行
+
+/**
+ * @brief 启动 strace -T 跟踪命令或附加到进程
+ * @param cmd_argv 被跟踪的命令 以NULL结尾 pid > 0 时忽略
+ * @param pid 要附加的进程 0 表示运行 cmd_argv
+ * @return 0 on success, -1 on failure
+ * @note strace 的输出通过管道交给父进程
+ */
+static int strace_start(char **cmd_argv, pid_t pid)
+{
+    // 创建管道
+    int pipefd[2];
+    if (pipe(pipefd) == -1)
+    {
+        perror("pipe");
+        return -1;
+    }
+
+    // fork() 系统调用
+    strace_pid = fork();
+    if (strace_pid < 0)
+    {
+        perror("fork");
+        return -1;
+    }
+
+    // 子进程：运行strace并重定向输出（同原实现，增强路径兼容性）
+    if (strace_pid == 0)
+    {
+        close(pipefd[0]);               // 关闭管道读端
+        dup2(pipefd[1], STDOUT_FILENO); // 标准输出重定向到管道写端
+        dup2(pipefd[1], STDERR_FILENO); // 标准错误重定向到管道写端
+        close(pipefd[1]);               // 关闭管道写端
+
+        // 自动搜索strace路径
+        char *strace_paths[] = {"/usr/bin/strace", "/bin/strace", NULL};
+
+        // 命令行参数转变为 execve 的参数...
+        int cmd_argc = 0;
+        while (pid == 0 && cmd_argv[cmd_argc] != NULL)
+            cmd_argc++;
+        char pid_str[16];
+        snprintf(pid_str, sizeof(pid_str), "%d", (int)pid);
+
+        char **exec_argv = malloc((cmd_argc + 5) * sizeof(char *));
+        int k = 0;
+        exec_argv[k++] = "strace";
+        exec_argv[k++] = "-T";
+        if (fd_live != NULL)
+            exec_argv[k++] = "-y"; // 让 strace 直接打印 fd 对应的路径
+        if (pid > 0)
+        {
+            exec_argv[k++] = "-p";
+            exec_argv[k++] = pid_str;
+        }
+        for (int i = 0; i < cmd_argc; i++)
+        {
+            exec_argv[k++] = cmd_argv[i];
+        }
+        exec_argv[k] = NULL;
+
+        // 寻找 strace 命令路径
+        char *exec_envp[] = {"PATH=/bin:/usr/bin", NULL};
+        for (int i = 0; strace_paths[i]; i++)
+        {
+            execve(strace_paths[i], exec_argv, exec_envp);
+        }
+        perror("execve strace");
+        free(exec_argv);
+        exit(1);
+    }
+
+    close(pipefd[1]);
+    strace_fd = pipefd[0];
+    return 0;
+}
+
+static int strace_pollfds(struct pollfd *fds, int max)
+{
+    fds[0].fd = strace_fd;
+    fds[0].events = POLLIN;
+    return 1;
+}
+
+/**
+ * @brief 读取一次管道数据并解析
+ * @param stats 系统调用统计信息
+ * @return 0 继续 1 strace 已结束
+ * @note none
+ */
+static int strace_process(syscall_stats *stats)
+{
+    char buffer[8192]; // 增大缓冲区减少read次数
+    ssize_t n = read(strace_fd, buffer, sizeof(buffer));
+    if (n == -1 && (errno == EINTR || errno == EAGAIN))
+        return 0;
+    if (n <= 0)
+        return 1;
+    feed_lines(&strace_lb, buffer, n, stats, fd_live);
+    return 0;
+}
+
+static void strace_finish(syscall_stats *stats)
+{
+    // 处理最后一行（无换行符）
+    if (strace_lb.len > 0)
+    {
+        strace_lb.buf[strace_lb.len] = '\0';
+        parse_strace_line(strace_lb.buf, stats, fd_live);
+        strace_lb.len = 0;
+    }
+
+    close(strace_fd);              // 关闭管道读端
+    waitpid(strace_pid, NULL, 0); // 等待子进程结束
+}
+
+// ======================== 按调用号跟踪的后端的公共部分 ========================
+
+// 每个线程尚未返回的系统调用 按 tid 直接映射
+typedef struct
+{
+    int tid;
+    int nr;
+    long arg0;
+    uint64_t time;
+    uint32_t stack; // 进入时的调用栈 未采集时为0
+} pending_syscall;
+
+// (pid, fd) -> 路径统计项 按 --fds 需要时读取 /proc/PID/fd
+typedef struct
+{
+    int pid;
+    int fd;
+    int slot; // 统计项下标+1 0表示空
+} fd_cache_entry;
+
+static fd_cache_entry proc_fd_cache[PROC_FD_CACHE];
+
+/**
+ * @brief 系统调用号对应的名称
+ * @param nr 系统调用号
+ * @param buf 未知调用号时用于格式化名称
+ * @param size buf 大小
+ * @return 名称
+ * @note none
+ */
+static const char *syscall_name(int nr, char *buf, size_t size)
+{
+    if (nr >= 0 && (size_t)nr < SYSCALL_NAMES_COUNT && syscall_names[nr] != NULL)
+        return syscall_names[nr];
+    snprintf(buf, size, "syscall_%d", nr);
+    return buf;
+}
+
+/**
+ * @brief 查找进程中 fd 对应的路径统计项
+ * @param pid 进程
+ * @param fd 文件描述符
+ * @return 统计项下标 无法解析时返回-1
+ * @note 缓存未命中时读取 /proc/PID/fd/FD 的链接
+ */
+static int proc_fd_slot(int pid, int fd)
+{
+    fd_cache_entry *e = &proc_fd_cache[(pid * 31u + fd) & (PROC_FD_CACHE - 1)];
+    if (e->slot != 0 && e->pid == pid && e->fd == fd)
+        return e->slot - 1;
+
+    char link[64], path[4096];
+    snprintf(link, sizeof(link), "/proc/%d/fd/%d", pid, fd);
+    ssize_t n = readlink(link, path, sizeof(path));
+    if (n <= 0)
+        return -1;
+
+    *e = (fd_cache_entry){.pid = pid, .fd = fd, .slot = fd_intern(fd_live, path, n) + 1};
+    return e->slot - 1;
+}
+
+/**
+ * @brief 让缓存中 (pid, fd) 的路径失效
+ * @param pid 进程
+ * @param fd 文件描述符
+ * @return void
+ * @note fd 被关闭或被新打开的文件复用时调用
+ */
+static void proc_fd_forget(int pid, long fd)
+{
+    fd_cache_entry *e = &proc_fd_cache[(pid * 31u + fd) & (PROC_FD_CACHE - 1)];
+    if (e->pid == pid && e->fd == fd)
+        e->slot = 0;
+}
+
+/**
+ * @brief 按 fd 统计一次配对好的系统调用
+ * @param pid 发起调用的进程（或线程）
+ * @param name 系统调用名称
+ * @param arg0 第一个参数
+ * @param ret 返回值
+ * @param time 耗时 单位秒
+ * @return void
+ * @note 关闭 fd 或返回新 fd 的调用会让缓存失效
+ */
+static void proc_fd_account(int pid, const char *name, long arg0, long ret, double time)
+{
+    size_t len = strlen(name);
+    if (is_fd_syscall(name, len))
+    {
+        fd_record(fd_live, pid, (int)arg0, proc_fd_slot(pid, (int)arg0), time);
+    }
+    else if (strcmp(name, "close") == 0)
+    {
+        proc_fd_forget(pid, arg0);
+    }
+    else if (ret >= 0 &&
+             (strncmp(name, "open", 4) == 0 || strcmp(name, "creat") == 0 ||
+              strncmp(name, "dup", 3) == 0 || strcmp(name, "socket") == 0 ||
+              strncmp(name, "accept", 6) == 0 || strcmp(name, "fcntl") == 0))
+    {
+        proc_fd_forget(pid, ret);
+    }
+}
+
+// ======================== perf_event 后端 ========================
+
+static const char *const tracefs_dirs[] = {
+    "/sys/kernel/tracing",
+    "/sys/kernel/debug/tracing",
+    NULL,
+};
+
+// 一个 CPU 上的 mmap 环形缓冲区
+typedef struct
+{
+    int fd;
+    struct perf_event_mmap_page *meta;
+    char *data;
+    size_t size;
+} perf_ring;
+
+// 从环形缓冲区中取出的一次 enter/exit 事件
+typedef struct
+{
+    uint64_t time;
+    int pid;
+    int tid;
+    int nr;
+    int enter;
+    long arg; // enter 时为第一个参数 exit 时为返回值
+} perf_sample;
+
+static perf_ring *perf_rings;
+static int perf_nrings;
+static int *perf_fds; // 所有打开的事件 结束时关闭
+static int perf_nfds;
+static pid_t perf_target = -1;
+static int perf_is_child;
+static int perf_enter_id, perf_exit_id;
+static int perf_nr_offset = 8;    // raw 数据中 long id 字段的偏移
+static int perf_arg_offset = 16;  // sys_enter 中 args[0] 的偏移
+static int perf_ret_offset = 16;  // sys_exit 中 ret 的偏移
+static unsigned long perf_lost;
+static perf_sample *perf_samples;
+static size_t perf_nsamples, perf_samples_cap;
+static pending_syscall perf_pending[PERF_TID_SLOTS];
+
+/**
+ * @brief 读取 tracefs 中的一个小文件
+ * @param rel 相对 tracefs 根目录的路径
+ * @param buf 读取结果
+ * @param size buf 大小
+ * @return 读取的字节数 失败返回-1
+ * @note 依次尝试 tracefs 的常见挂载点
+ */
+static ssize_t read_tracefs(const char *rel, char *buf, size_t size)
+{
+    for (int i = 0; tracefs_dirs[i]; i++)
+    {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s", tracefs_dirs[i], rel);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            continue;
+        ssize_t n = read(fd, buf, size - 1);
+        close(fd);
+        if (n >= 0)
+        {
+            buf[n] = '\0';
+            return n;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 在 tracepoint 的 format 描述中查找字段偏移
+ * @param format format 文件内容
+ * @param field 字段声明的结尾 如 " id;"
+ * @param offset 找到时写入偏移
+ * @return void
+ * @note 找不到时保留默认值
+ */
+static void tracefs_field_offset(const char *format, const char *field, int *offset)
+{
+    const char *f = strstr(format, field);
+    const char *o = f ? strstr(f, "offset:") : NULL;
+    if (o != NULL)
+        *offset = atoi(o + strlen("offset:"));
+}
+
+/**
+ * @brief 读取 raw_syscalls 两个 tracepoint 的 id 和各字段的偏移
+ * @param void
+ * @return 0 on success, -1 on failure
+ * @note none
+ */
+static int perf_load_tracepoints(void)
+{
+    char buf[4096];
+    if (read_tracefs("events/raw_syscalls/sys_enter/id", buf, sizeof(buf)) <= 0)
+        return -1;
+    perf_enter_id = atoi(buf);
+    if (read_tracefs("events/raw_syscalls/sys_exit/id", buf, sizeof(buf)) <= 0)
+        return -1;
+    perf_exit_id = atoi(buf);
+
+    // 形如 "field:long id;	offset:8;	size:8;	signed:1;"
+    if (read_tracefs("events/raw_syscalls/sys_enter/format", buf, sizeof(buf)) > 0)
+    {
+        tracefs_field_offset(buf, " id;", &perf_nr_offset);
+        tracefs_field_offset(buf, " args[6];", &perf_arg_offset);
+    }
+    if (read_tracefs("events/raw_syscalls/sys_exit/format", buf, sizeof(buf)) > 0)
+        tracefs_field_offset(buf, " ret;", &perf_ret_offset);
+    return 0;
+}
+
+static int perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu)
+{
+    return syscall(SYS_perf_event_open, attr, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+/**
+ * @brief 在一个 CPU 上为一个线程打开 enter/exit 事件
+ * @param tid 线程
+ * @param cpu CPU
+ * @param ring 该 CPU 的环形缓冲区 fd 为-1时由本次打开的事件建立
+ * @param enable_on_exec 是否等到 exec 时才开始计数
+ * @return 0 on success, -1 on failure
+ * @note exit 事件以及其他线程的事件都重定向到同一个缓冲区
+ */
+static int perf_open_task(pid_t tid, int cpu, perf_ring *ring, int enable_on_exec)
+{
+    int ids[2] = {perf_enter_id, perf_exit_id};
+    for (int k = 0; k < 2; k++)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.config = ids[k];
+        attr.sample_period = 1;
+        attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_RAW;
+        attr.inherit = 1;
+        attr.disabled = enable_on_exec;
+        attr.enable_on_exec = enable_on_exec;
+        attr.watermark = 1;
+        attr.wakeup_watermark = PERF_RING_PAGES * 4096 / 4;
+
+        int fd = perf_event_open(&attr, tid, cpu);
+        if (fd == -1)
+            return -1;
+        perf_fds[perf_nfds++] = fd;
+
+        if (ring->fd == -1)
+        {
+            size_t len = (PERF_RING_PAGES + 1) * 4096;
+            void *m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (m == MAP_FAILED)
+                return -1;
+            ring->fd = fd;
+            ring->meta = m;
+            ring->data = (char *)m + 4096;
+            ring->size = PERF_RING_PAGES * 4096;
+        }
+        else if (ioctl(fd, PERF_EVENT_IOC_SET_OUTPUT, ring->fd) == -1)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 启动 perf 后端
+ * @param cmd_argv 被跟踪的命令 以NULL结尾 pid > 0 时忽略
+ * @param pid 要附加的进程 0 表示运行 cmd_argv
+ * @return 0 on success, -1 on failure
+ * @note 运行命令时子进程先停在管道上 事件打开后才 exec
+ *       enable_on_exec 保证只统计 exec 之后的系统调用
+ *       附加到进程时为 /proc/PID/task 下的每个线程打开事件
+ */
+static int perf_start(char **cmd_argv, pid_t pid)
+{
+    if (perf_load_tracepoints() != 0)
+    {
+        fprintf(stderr, "sperf: cannot read raw_syscalls tracepoint ids from tracefs "
+                        "(is tracefs mounted and readable?)\n");
+        return -1;
+    }
+
+    int go[2] = {-1, -1};
+    perf_is_child = pid == 0;
+    if (perf_is_child)
+    {
+        if (pipe(go) == -1)
+        {
+            perror("pipe");
+            return -1;
+        }
+        pid = fork();
+        if (pid < 0)
+        {
+            perror("fork");
+            return -1;
+        }
+        if (pid == 0)
+        {
+            // 等父进程打开事件后再 exec
+            char c;
+            close(go[1]);
+            if (read(go[0], &c, 1) != 1)
+                _exit(1);
+            close(go[0]);
+            execvp(cmd_argv[0], cmd_argv);
+            perror(cmd_argv[0]);
+            _exit(127);
+        }
+        close(go[0]);
+    }
+    perf_target = pid;
+
+    // 需要跟踪的线程
+    static pid_t tids[PERF_MAX_TASKS];
+    int ntids = 0;
+    if (perf_is_child)
+    {
+        tids[ntids++] = pid;
+    }
+    else
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/task", (int)pid);
+        DIR *d = opendir(path);
+        struct dirent *ent;
+        while (d != NULL && (ent = readdir(d)) != NULL && ntids < PERF_MAX_TASKS)
+        {
+            if (is_digit(ent->d_name[0]))
+                tids[ntids++] = atoi(ent->d_name);
+        }
+        if (d != NULL)
+            closedir(d);
+        if (ntids == 0)
+        {
+            fprintf(stderr, "sperf: no such process %d\n", (int)pid);
+            return -1;
+        }
+    }
+
+    int ncpu = (int)sysconf(_SC_NPROCESSORS_CONF);
+    perf_rings = calloc(ncpu, sizeof(perf_ring));
+    perf_fds = calloc((size_t)ncpu * ntids * 2, sizeof(int));
+    int ok = 0;
+    for (int cpu = 0; cpu < ncpu; cpu++)
+    {
+        perf_ring *ring = &perf_rings[perf_nrings];
+        ring->fd = -1;
+        for (int t = 0; t < ntids; t++)
+        {
+            if (perf_open_task(tids[t], cpu, ring, perf_is_child) != 0)
+            {
+                // 离线的 CPU 直接跳过
+                if (errno == ENODEV && ring->fd == -1)
+                    break;
+                if (errno == ESRCH)
+                    continue;
+                int err = errno;
+                FILE *f = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+                int paranoid = 0;
+                if (f != NULL)
+                {
+                    if (fscanf(f, "%d", &paranoid) != 1)
+                        paranoid = 0;
+                    fclose(f);
+                }
+                fprintf(stderr, "sperf: perf_event_open: %s", strerror(err));
+                if (err == EACCES || err == EPERM)
+                    fprintf(stderr, " (kernel.perf_event_paranoid=%d; tracepoints need <= 1 "
+                                    "or CAP_PERFMON)", paranoid);
+                fprintf(stderr, "\n");
+                goto fail;
+            }
+        }
+        if (ring->fd != -1)
+        {
+            perf_nrings++;
+            ok = 1;
+        }
+    }
+    if (!ok)
+        goto fail;
+
+    if (perf_is_child)
+    {
+        if (write(go[1], "g", 1) != 1)
+            goto fail;
+        close(go[1]);
+    }
+    return 0;
+
+fail:
+    if (perf_is_child)
+    {
+        close(go[1]);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+    return -1;
+}
+
+static int perf_pollfds(struct pollfd *fds, int max)
+{
+    int n = 0;
+    for (int i = 0; i < perf_nrings && n < max; i++)
+    {
+        fds[n].fd = perf_rings[i].fd;
+        fds[n].events = POLLIN;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @brief 取出一个环形缓冲区中的所有记录
+ * @param ring 环形缓冲区
+ * @return void
+ * @note 跨越缓冲区末尾的记录先拷贝出来再解析
+ */
+static void perf_drain_ring(perf_ring *ring)
+{
+    uint64_t head = __atomic_load_n(&ring->meta->data_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->meta->data_tail;
+    char rec[4096];
+
+    while (tail < head)
+    {
+        struct perf_event_header hdr;
+        size_t off = tail % ring->size;
+        for (size_t i = 0; i < sizeof(hdr); i++)
+            ((char *)&hdr)[i] = ring->data[(off + i) % ring->size];
+        if (hdr.size == 0 || hdr.size > sizeof(rec))
+            break;
+        for (size_t i = 0; i < hdr.size; i++)
+            rec[i] = ring->data[(off + i) % ring->size];
+        tail += hdr.size;
+
+        if (hdr.type == PERF_RECORD_LOST)
+        {
+            perf_lost += *(uint64_t *)(rec + sizeof(hdr) + 8);
+            continue;
+        }
+        if (hdr.type != PERF_RECORD_SAMPLE)
+            continue;
+
+        // PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_RAW
+        const char *p = rec + sizeof(hdr);
+        uint32_t pid = *(uint32_t *)p;
+        uint32_t tid = *(uint32_t *)(p + 4);
+        uint64_t time = *(uint64_t *)(p + 8);
+        uint32_t raw_size = *(uint32_t *)(p + 16);
+        const char *raw = p + 20;
+        if (raw_size < (uint32_t)perf_nr_offset + sizeof(long))
+            continue;
+
+        uint16_t type = *(uint16_t *)raw;
+        int arg_offset = type == perf_enter_id ? perf_arg_offset : perf_ret_offset;
+        long nr, arg = 0;
+        memcpy(&nr, raw + perf_nr_offset, sizeof(nr));
+        if (raw_size >= (uint32_t)arg_offset + sizeof(long))
+            memcpy(&arg, raw + arg_offset, sizeof(arg));
+
+        if (perf_nsamples == perf_samples_cap)
+        {
+            perf_samples_cap = perf_samples_cap ? perf_samples_cap * 2 : 4096;
+            perf_samples = realloc(perf_samples, perf_samples_cap * sizeof(perf_sample));
+        }
+        perf_samples[perf_nsamples++] = (perf_sample){
+            .time = time,
+            .pid = (int)pid,
+            .tid = (int)tid,
+            .nr = (int)nr,
+            .enter = type == perf_enter_id,
+            .arg = arg,
+        };
+    }
+
+    __atomic_store_n(&ring->meta->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+static int perf_sample_cmp(const void *a, const void *b)
+{
+    const perf_sample *x = a, *y = b;
+    return x->time < y->time ? -1 : x->time > y->time;
+}
+
+/**
+ * @brief 取出所有 CPU 的事件 按时间排序后配对 enter/exit
+ * @param stats 系统调用统计信息
+ * @return 0 继续 1 目标进程已结束
+ * @note 同一线程的 enter 和 exit 可能落在不同 CPU 的缓冲区
+ *       先合并排序再配对 未配对的 enter 留到下一轮
+ */
+static int perf_process(syscall_stats *stats)
+{
+    // 先检查目标是否结束 再取数据 保证结束前的事件都被取到
+    int done;
+    if (perf_is_child)
+        done = waitpid(perf_target, NULL, WNOHANG) == perf_target;
+    else
+        done = kill(perf_target, 0) == -1 && errno == ESRCH;
+
+    perf_nsamples = 0;
+    for (int i = 0; i < perf_nrings; i++)
+        perf_drain_ring(&perf_rings[i]);
+    qsort(perf_samples, perf_nsamples, sizeof(perf_sample), perf_sample_cmp);
+
+    for (size_t i = 0; i < perf_nsamples; i++)
+    {
+        const perf_sample *e = &perf_samples[i];
+        pending_syscall *slot = &perf_pending[e->tid & (PERF_TID_SLOTS - 1)];
+        if (e->enter)
+        {
+            *slot = (pending_syscall){.tid = e->tid, .nr = e->nr, .arg0 = e->arg, .time = e->time};
+        }
+        else if (slot->tid == e->tid && slot->nr == e->nr && e->time >= slot->time)
+        {
+            char buf[32];
+            const char *name = syscall_name(e->nr, buf, sizeof(buf));
+            double time = corrected_time((e->time - slot->time) / 1e9);
+            stat_record(stats, name, strlen(name), time);
+            if (fd_live != NULL)
+                proc_fd_account(e->pid, name, slot->arg0, e->arg, time);
+            slot->tid = 0;
+        }
+    }
+    return done;
+}
+
+static void perf_finish(syscall_stats *stats)
+{
+    for (int i = 0; i < perf_nrings; i++)
+        munmap(perf_rings[i].meta, (PERF_RING_PAGES + 1) * 4096);
+    for (int i = 0; i < perf_nfds; i++)
+        close(perf_fds[i]);
+    if (perf_is_child)
+        waitpid(perf_target, NULL, 0);
+    if (perf_lost > 0)
+        fprintf(stderr, "sperf: perf ring buffer overflowed, lost %lu events\n", perf_lost);
+    free(perf_rings);
+    free(perf_fds);
+    free(perf_samples);
+    // 复位 以便同一进程内再次启动（校准时会依次运行多次）
+    perf_rings = NULL;
+    perf_fds = NULL;
+    perf_samples = NULL;
+    perf_nrings = perf_nfds = 0;
+    perf_nsamples = perf_samples_cap = 0;
+    perf_lost = 0;
+}
+
+// ======================== 调用栈存储 ========================
+
+// 哈希合并的调用栈前缀树 相同的前缀只存一次 节点数有上限 内存不随运行时间增长
+static uint32_t stack_count;
+static uint32_t *stack_index; // 开放寻址 存节点号 0表示空
+static unsigned long stack_truncated;
+
+// 帧所在的模块 只记文件名
+static char stack_modules[MAX_MODULES][64];
+static int stack_module_count;
+
+// 每个进程的可执行映射 按 pid 直接映射的缓存
+typedef struct
+{
+    uint64_t start;
+    uint64_t end;
+    uint64_t offset;
+    int module;
+} exec_map;
+
+typedef struct
+{
+    int pid;
+    int count;
+    exec_map maps[MAX_MAPS];
+} proc_maps;
+
+static proc_maps *maps_cache;
+
+/**
+ * @brief 初始化调用栈存储
+ * @param void
+ * @return 0 on success, -1 on failure
+ * @note 0 号节点是根 0 号模块是 "[unknown]"
+ */
+int stack_init(void)
+{
+    stack_nodes = calloc(STACK_NODES, sizeof(stack_node));
+    stack_index = calloc(STACK_INDEX_SIZE, sizeof(uint32_t));
+    maps_cache = calloc(MAPS_CACHE, sizeof(proc_maps));
+    if (stack_nodes == NULL || stack_index == NULL || maps_cache == NULL)
+    {
+        perror("calloc");
+        return -1;
+    }
+    stack_count = 1;
+    snprintf(stack_modules[0], sizeof(stack_modules[0]), "[unknown]");
+    stack_module_count = 1;
+    return 0;
+}
+
+/**
+ * @brief 查找或新建前缀树节点
+ * @param parent 父节点
+ * @param module 模块下标 STACK_SYSCALL 表示系统调用叶子
+ * @param offset 模块内偏移 或系统调用统计项下标
+ * @return 节点号
+ * @note 节点用完后不再新建 返回父节点 即把栈截断在已有的前缀上
+ */
+uint32_t stack_intern(uint32_t parent, uint32_t module, uint64_t offset)
+{
+    uint64_t key = ((uint64_t)parent * 0x9E3779B97F4A7C15ull) ^ (offset * 0xC2B2AE3D27D4EB4Full) ^ module;
+    uint32_t h = (uint32_t)(key ^ (key >> 32)) & (STACK_INDEX_SIZE - 1);
+    while (stack_index[h] != 0)
+    {
+        stack_node *n = &stack_nodes[stack_index[h]];
+        if (n->parent == parent && n->module == module && n->offset == offset)
+            return stack_index[h];
+        h = (h + 1) & (STACK_INDEX_SIZE - 1);
+    }
+
+    if (stack_count >= STACK_NODES)
+    {
+        stack_truncated++;
+        return parent;
+    }
+    uint32_t id = stack_count++;
+    stack_nodes[id] = (stack_node){.parent = parent, .module = module, .offset = offset};
+    stack_index[h] = id;
+    return id;
+}
+
+/**
+ * @brief 记录一次系统调用在某个调用栈上的耗时
+ * @param stack 调用栈的最内层节点
+ * @param stat 系统调用统计项下标
+ * @param time 耗时 单位秒
+ * @return void
+ * @note 系统调用本身作为叶子挂在调用栈下面
+ */
+void stack_record(uint32_t stack, int stat, double time)
+{
+    uint32_t leaf = stack_intern(stack, STACK_SYSCALL, stat);
+    if (stack_nodes[leaf].module != STACK_SYSCALL)
+        return;
+    stack_nodes[leaf].time += time;
+    stack_nodes[leaf].count++;
+}
+
+/**
+ * @brief 驻留模块名
+ * @param path 映射的路径
+ * @return 模块下标 表满时返回0
+ * @note 只保留文件名部分
+ */
+static int stack_module(const char *path)
+{
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    for (int i = 0; i < stack_module_count; i++)
+    {
+        if (strncmp(stack_modules[i], base, sizeof(stack_modules[i]) - 1) == 0)
+            return i;
+    }
+    if (stack_module_count >= MAX_MODULES)
+        return 0;
+    snprintf(stack_modules[stack_module_count], sizeof(stack_modules[0]), "%s", base);
+    return stack_module_count++;
+}
+
+/**
+ * @brief 读取进程的可执行映射
+ * @param pm 缓存项
+ * @param pid 进程（或线程）
+ * @return void
+ * @note 只保留带 x 权限的映射
+ */
+static void load_maps(proc_maps *pm, int pid)
+{
+    char path[64], line[512];
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+    pm->pid = pid;
+    pm->count = 0;
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return;
+    while (fgets(line, sizeof(line), f) != NULL && pm->count < MAX_MAPS)
+    {
+        // 形如 "7f..-7f.. r-xp 00028000 08:01 1234   /usr/lib/libc.so.6"
+        unsigned long start, end, offset;
+        char perms[8];
+        int name_at = 0;
+        if (sscanf(line, "%lx-%lx %7s %lx %*s %*s %n", &start, &end, perms, &offset, &name_at) < 4)
+            continue;
+        if (perms[2] != 'x')
+            continue;
+        char *name = line + name_at;
+        name[strcspn(name, "\n")] = '\0';
+        pm->maps[pm->count++] = (exec_map){
+            .start = start,
+            .end = end,
+            .offset = offset,
+            .module = stack_module(*name ? name : "[anon]"),
+        };
+    }
+    fclose(f);
+}
+
+/**
+ * @brief 把进程中的地址转换为 (模块, 模块内偏移)
+ * @param pid 进程（或线程）
+ * @param pc 地址
+ * @param offset 模块内的文件偏移 找不到模块时为原地址
+ * @return 模块下标
+ * @note 缓存未命中或地址不在已知映射中时重新读取 maps
+ */
+static int resolve_pc(int pid, uint64_t pc, uint64_t *offset)
+{
+    proc_maps *pm = &maps_cache[pid & (MAPS_CACHE - 1)];
+    int fresh = pm->pid != pid;
+    if (fresh)
+        load_maps(pm, pid);
+    while (1)
+    {
+        for (int i = 0; i < pm->count; i++)
+        {
+            if (pc >= pm->maps[i].start && pc < pm->maps[i].end)
+            {
+                *offset = pc - pm->maps[i].start + pm->maps[i].offset;
+                return pm->maps[i].module;
+            }
+        }
+        // 可能是之后 mmap 的库 重新读一次
+        if (fresh)
+            break;
+        load_maps(pm, pid);
+        fresh = 1;
+    }
+    *offset = pc;
+    return 0;
+}
+
+/**
+ * @brief 让某个进程的映射缓存失效
+ * @param pid 进程（或线程）
+ * @return void
+ * @note exec 之后调用
+ */
+static void forget_maps(int pid)
+{
+    proc_maps *pm = &maps_cache[pid & (MAPS_CACHE - 1)];
+    if (pm->pid == pid)
+        pm->pid = 0;
+}
+
+/**
+ * @brief 格式化一个帧
+ * @param n 节点
+ * @param buf 结果
+ * @param size buf 大小
+ * @return void
+ * @note 形如 libc.so.6+0x114a5d 未知模块直接打印地址
+ */
+static void stack_frame_name(const stack_node *n, char *buf, size_t size)
+{
+    if (n->module == 0)
+        snprintf(buf, size, "0x%lx", (unsigned long)n->offset);
+    else
+        snprintf(buf, size, "%s+0x%lx", stack_modules[n->module], (unsigned long)n->offset);
+}
+
+/**
+ * @brief 把调用栈以 collapsed 格式写到文件
+ * @param path 输出文件
+ * @param stats 系统调用统计信息 用于取叶子的名字
+ * @return 0 on success, -1 on failure
+ * @note 每行 "外层帧;...;内层帧;系统调用 微秒" 可直接交给 flamegraph.pl
+ */
+int stack_dump(const char *path, const syscall_stats *stats)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    uint32_t chain[STACK_DEPTH + 1];
+    for (uint32_t id = 1; id < stack_count; id++)
+    {
+        const stack_node *leaf = &stack_nodes[id];
+        if (leaf->module != STACK_SYSCALL || leaf->count == 0)
+            continue;
+
+        int depth = 0;
+        for (uint32_t p = leaf->parent; p != 0 && depth <= STACK_DEPTH; p = stack_nodes[p].parent)
+            chain[depth++] = p;
+        for (int i = depth - 1; i >= 0; i--)
+        {
+            char frame[128];
+            stack_frame_name(&stack_nodes[chain[i]], frame, sizeof(frame));
+            fprintf(f, "%s;", frame);
+        }
+        long us = lround(leaf->time * 1e6);
+        fprintf(f, "%s %ld\n", stats->stats[leaf->offset].name, us > 0 ? us : 1);
+    }
+
+    if (stack_truncated > 0)
+        fprintf(stderr, "sperf: stack store full, %lu stacks truncated\n", stack_truncated);
+    fclose(f);
+    return 0;
+}
+
+/**
+ * @brief 把某个系统调用最耗时的调用栈格式化到报告中
+ * @param report 报告缓冲区
+ * @param off 已写入的长度
+ * @param size 缓冲区大小
+ * @param stat 系统调用在 stats 中的下标
+ * @param total 该系统调用的总耗时
+ * @return 新的已写入长度
+ * @note 每个调用栈只显示最内层的 STACK_SHOW_FRAMES 帧
+ */
+size_t stack_format_callers(char *report, size_t off, size_t size, int stat, double total)
+{
+    uint32_t top[STACK_TOP_N] = {0};
+    for (uint32_t id = 1; id < stack_count; id++)
+    {
+        const stack_node *n = &stack_nodes[id];
+        if (n->module != STACK_SYSCALL || n->offset != (uint64_t)stat)
+            continue;
+        for (int k = 0; k < STACK_TOP_N; k++)
+        {
+            if (top[k] == 0 || n->time > stack_nodes[top[k]].time)
+            {
+                memmove(&top[k + 1], &top[k], (STACK_TOP_N - k - 1) * sizeof(top[0]));
+                top[k] = id;
+                break;
+            }
+        }
+    }
+
+    for (int k = 0; k < STACK_TOP_N && top[k] != 0 && off < size; k++)
+    {
+        const stack_node *leaf = &stack_nodes[top[k]];
+        off += snprintf(report + off, size - off, " ");
+        uint32_t p = leaf->parent;
+        for (int d = 0; d < STACK_SHOW_FRAMES && p != 0 && off < size; d++, p = stack_nodes[p].parent)
+        {
+            char frame[128];
+            stack_frame_name(&stack_nodes[p], frame, sizeof(frame));
+            off += snprintf(report + off, size - off, " <- %s", frame);
+        }
+        if (off < size)
+            off += snprintf(report + off, size - off, " (%d%%)\n",
+                            total > 0 ? (int)(leaf->time / total * 100) : 0);
+    }
+    return off;
+}
+
+// ======================== 原生 ptrace 后端 ========================
+
+static pid_t ptrace_target = -1;
+static int ptrace_is_child;
+static int ptrace_sigfd = -1;
+static int ptrace_seen[PERF_TID_SLOTS]; // 已经停下过的线程 首次停止时设置选项
+// 被跟踪的线程集合 按完整 tid 开放定址 线性探测 0 表示空槽
+// 不能靠 ECHILD 判断结束 进程可能还有别的子进程
+static pid_t ptrace_tids[PERF_TID_SLOTS];
+static int ptrace_live; // 集合中的线程数
+static pending_syscall ptrace_pending[PERF_TID_SLOTS];
+
+static int tid_home(pid_t tid)
+{
+    return (int)(((uint32_t)tid * 2654435761u) >> 16) & (PERF_TID_SLOTS - 1);
+}
+
+/**
+ * @brief 把线程加入被跟踪的集合
+ * @param tid 线程
+ * @return void
+ * @note 已在集合中时不变
+ */
+static void tid_set_add(pid_t tid)
+{
+    int i = tid_home(tid);
+    for (int n = 0; n < PERF_TID_SLOTS && ptrace_tids[i] != 0; n++)
+    {
+        if (ptrace_tids[i] == tid)
+            return;
+        i = (i + 1) & (PERF_TID_SLOTS - 1);
+    }
+    if (ptrace_tids[i] == 0)
+    {
+        ptrace_tids[i] = tid;
+        ptrace_live++;
+    }
+}
+
+/**
+ * @brief 把已退出的线程移出集合
+ * @param tid 线程
+ * @return 1 tid 在集合中 0 不在（不是被跟踪的线程）
+ * @note 删除后把探测链上后面的项前移 不留墓碑
+ */
+static int tid_set_remove(pid_t tid)
+{
+    int i = tid_home(tid);
+    while (ptrace_tids[i] != tid)
+    {
+        if (ptrace_tids[i] == 0)
+            return 0;
+        i = (i + 1) & (PERF_TID_SLOTS - 1);
+    }
+    for (int j = (i + 1) & (PERF_TID_SLOTS - 1); ptrace_tids[j] != 0; j = (j + 1) & (PERF_TID_SLOTS - 1))
+    {
+        // j 的原始位置不在 (i, j] 之间时 移到空出的 i
+        int home = tid_home(ptrace_tids[j]);
+        if (((j - home) & (PERF_TID_SLOTS - 1)) >= ((j - i) & (PERF_TID_SLOTS - 1)))
+        {
+            ptrace_tids[i] = ptrace_tids[j];
+            i = j;
+        }
+    }
+    ptrace_tids[i] = 0;
+    ptrace_live--;
+    return 1;
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief 读取被跟踪线程的帧指针
+ * @param tid 线程
+ * @return 帧指针 不支持的架构或失败时返回0
+ * @note none
+ */
+static uint64_t tracee_frame_pointer(pid_t tid)
+{
+#if defined(__x86_64__)
+    struct user_regs_struct regs;
+    if (ptrace(PTRACE_GETREGS, tid, 0, &regs) == -1)
+        return 0;
+    return regs.rbp;
+#elif defined(__aarch64__)
+    struct user_regs_struct regs;
+    struct iovec iov = {.iov_base = &regs, .iov_len = sizeof(regs)};
+    if (ptrace(PTRACE_GETREGSET, tid, NT_PRSTATUS, &iov) == -1)
+        return 0;
+    return regs.regs[29];
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief 读取被跟踪线程的内存
+ * @param tid 线程
+ * @param addr 地址
+ * @param buf 结果
+ * @param len 长度 须为 sizeof(long) 的倍数
+ * @return 0 on success, -1 on failure
+ * @note 优先用 process_vm_readv 一次读完 不可用时逐字 PTRACE_PEEKDATA
+ */
+static int tracee_read(pid_t tid, uint64_t addr, void *buf, size_t len)
+{
+    struct iovec local = {.iov_base = buf, .iov_len = len};
+    struct iovec remote = {.iov_base = (void *)addr, .iov_len = len};
+    if (process_vm_readv(tid, &local, 1, &remote, 1, 0) == (ssize_t)len)
+        return 0;
+
+    for (size_t i = 0; i < len; i += sizeof(long))
+    {
+        errno = 0;
+        long word = ptrace(PTRACE_PEEKDATA, tid, addr + i, 0);
+        if (errno != 0)
+            return -1;
+        memcpy((char *)buf + i, &word, sizeof(word));
+    }
+    return 0;
+}
+
+/**
+ * @brief 在系统调用入口采集用户态调用栈
+ * @param tid 线程
+ * @param pc 系统调用指令之后的地址
+ * @param sp 栈指针
+ * @return 调用栈最内层的节点
+ * @note 沿帧指针链回溯 每帧是 [fp] = 上一帧 fp, [fp+8] = 返回地址
+ *       被测程序需以 -fno-omit-frame-pointer 编译 否则栈会很浅
+ *       libc 的系统调用包装函数多是叶函数 不建立栈帧 直接调用者的返回地址在 [sp]
+ *       帧指针链则从调用者的调用者开始 所以先取 [sp]
+ *       非叶的包装函数 [sp] 上是保存的寄存器 指向栈或不在可执行映射中的值跳过
+ */
+static uint32_t capture_stack(pid_t tid, uint64_t pc, uint64_t sp)
+{
+    uint64_t frames[STACK_DEPTH];
+    int n = 0;
+    frames[n++] = pc;
+
+    uint64_t ret, offset;
+    if (tracee_read(tid, sp, &ret, sizeof(ret)) == 0 &&
+        (ret < sp - STACK_MAX_FRAME || ret > sp + STACK_MAX_FRAME) &&
+        resolve_pc(tid, ret, &offset) != 0)
+        frames[n++] = ret;
+
+    uint64_t fp = tracee_frame_pointer(tid);
+    while (n < STACK_DEPTH && fp != 0 && fp >= sp && (fp & 7) == 0)
+    {
+        uint64_t frame[2];
+        if (tracee_read(tid, fp, frame, sizeof(frame)) != 0 || frame[1] == 0)
+            break;
+        frames[n++] = frame[1];
+        // 栈向低地址增长 上一帧必然在更高的地址
+        if (frame[0] <= fp || frame[0] - fp > STACK_MAX_FRAME)
+            break;
+        fp = frame[0];
+    }
+
+    // 从最外层开始插入前缀树
+    uint32_t node = 0;
+    for (int i = n - 1; i >= 0; i--)
+    {
+        uint64_t offset;
+        int module = resolve_pc(tid, frames[i], &offset);
+        node = stack_intern(node, module, offset);
+    }
+    return node;
+}
+
+/**
+ * @brief 处理一次 syscall-stop
+ * @param tid 线程
+ * @param stats 系统调用统计信息
+ * @return void
+ * @note 入口记下调用号、参数、时间和调用栈 出口配对后计入统计
+ */
+static void ptrace_syscall_stop(pid_t tid, syscall_stats *stats)
+{
+    struct __ptrace_syscall_info info;
+    if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, sizeof(info), &info) <= 0)
+        return;
+
+    pending_syscall *slot = &ptrace_pending[tid & (PERF_TID_SLOTS - 1)];
+    if (info.op == PTRACE_SYSCALL_INFO_ENTRY)
+    {
+        *slot = (pending_syscall){
+            .tid = tid,
+            .nr = (int)info.entry.nr,
+            .arg0 = (long)info.entry.args[0],
+        };
+        if (stack_nodes != NULL)
+            slot->stack = capture_stack(tid, info.instruction_pointer, info.stack_pointer);
+        // 最后取时间 不把采集调用栈的开销算进去
+        slot->time = monotonic_ns();
+    }
+    else if (info.op == PTRACE_SYSCALL_INFO_EXIT && slot->tid == tid)
+    {
+        double time = corrected_time((monotonic_ns() - slot->time) / 1e9);
+        char buf[32];
+        const char *name = syscall_name(slot->nr, buf, sizeof(buf));
+        syscall_stat *st = stat_lookup(stats, name, strlen(name));
+        if (st != NULL)
+        {
+            st->total_time += time;
+            st->count++;
+            st->hist[hist_bucket(time)]++;
+            stats->total_time += time;
+            if (stack_nodes != NULL)
+                stack_record(slot->stack, (int)(st - stats->stats), time);
+        }
+        if (fd_live != NULL)
+            proc_fd_account(tid, name, slot->arg0, (long)info.exit.rval, time);
+        slot->tid = 0;
+    }
+}
+
+/**
+ * @brief 启动原生 ptrace 后端
+ * @param cmd_argv 被跟踪的命令 以NULL结尾 pid > 0 时忽略
+ * @param pid 要附加的进程 0 表示运行 cmd_argv
+ * @return 0 on success, -1 on failure
+ * @note 不经过 strace 自己处理 syscall-stop 可以在入口处采集调用栈
+ *       停止通知通过 signalfd 接入事件循环
+ */
+static int ptrace_start(char **cmd_argv, pid_t pid)
+{
+    memset(ptrace_seen, 0, sizeof(ptrace_seen));
+    memset(ptrace_tids, 0, sizeof(ptrace_tids));
+    ptrace_live = 0;
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    ptrace_sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (ptrace_sigfd == -1)
+    {
+        perror("signalfd");
+        return -1;
+    }
+
+    ptrace_is_child = pid == 0;
+    if (ptrace_is_child)
+    {
+        pid = fork();
+        if (pid < 0)
+        {
+            perror("fork");
+            return -1;
+        }
+        if (pid == 0)
+        {
+            sigprocmask(SIG_UNBLOCK, &mask, NULL);
+            ptrace(PTRACE_TRACEME, 0, 0, 0);
+            raise(SIGSTOP);
+            execvp(cmd_argv[0], cmd_argv);
+            perror(cmd_argv[0]);
+            _exit(127);
+        }
+        tid_set_add(pid);
+    }
+    else
+    {
+        // 附加到进程的每个线程
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/task", (int)pid);
+        DIR *d = opendir(path);
+        struct dirent *ent;
+        while (d != NULL && (ent = readdir(d)) != NULL)
+        {
+            if (is_digit(ent->d_name[0]) && ptrace(PTRACE_ATTACH, atoi(ent->d_name), 0, 0) == 0)
+                tid_set_add(atoi(ent->d_name));
+        }
+        if (d != NULL)
+            closedir(d);
+        if (ptrace_live == 0)
+        {
+            perror("ptrace attach");
+            return -1;
+        }
+    }
+    ptrace_target = pid;
+    return 0;
+}
+
+static int ptrace_pollfds(struct pollfd *fds, int max)
+{
+    fds[0].fd = ptrace_sigfd;
+    fds[0].events = POLLIN;
+    return 1;
+}
+
+/**
+ * @brief 处理已经停下的被跟踪线程
+ * @param stats 系统调用统计信息
+ * @return 0 继续 1 所有被跟踪的线程都已退出
+ * @note 一次最多处理 PTRACE_BATCH 次停止 让定时器有机会输出报告
+ *       线程第一次停止时的 SIGSTOP 来自附加本身 不转发
+ *       退出按 ptrace_tids 计数 与是否停下过无关 附加后未停下就退出的线程也算
+ */
+static int ptrace_process(syscall_stats *stats)
+{
+    struct signalfd_siginfo si;
+    while (read(ptrace_sigfd, &si, sizeof(si)) == sizeof(si))
+        ;
+
+    for (int n = 0; n < PTRACE_BATCH; n++)
+    {
+        int status;
+        pid_t tid = waitpid(-1, &status, __WALL | WNOHANG);
+        if (tid == 0)
+            break;
+        if (tid == -1)
+            return errno == ECHILD;
+        if (!WIFSTOPPED(status))
+        {
+            int *seen = &ptrace_seen[tid & (PERF_TID_SLOTS - 1)];
+            if (*seen == tid)
+                *seen = 0;
+            if (tid_set_remove(tid) && ptrace_live == 0)
+                return 1;
+            continue;
+        }
+
+        int sig = WSTOPSIG(status);
+        int event = status >> 16;
+        int inject = 0;
+        int *seen = &ptrace_seen[tid & (PERF_TID_SLOTS - 1)];
+
+        if (*seen != tid)
+        {
+            // 新线程的第一次停止可能先于父线程的事件停止到达
+            *seen = tid;
+            tid_set_add(tid);
+            long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC | PTRACE_O_TRACEFORK |
+                           PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE;
+            if (ptrace_is_child)
+                options |= PTRACE_O_EXITKILL;
+            ptrace(PTRACE_SETOPTIONS, tid, 0, options);
+            if (sig != SIGSTOP)
+                inject = sig == (SIGTRAP | 0x80) ? 0 : sig;
+        }
+        else if (sig == (SIGTRAP | 0x80))
+        {
+            ptrace_syscall_stop(tid, stats);
+        }
+        else if (event != 0)
+        {
+            // 新线程在父线程的事件停止时就计入 避免父线程先退出时误判结束
+            // 新线程可能已经停下、退出并被回收 kill 探测不到时不再加入
+            unsigned long child;
+            if ((event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK ||
+                 event == PTRACE_EVENT_CLONE) &&
+                ptrace(PTRACE_GETEVENTMSG, tid, 0, &child) == 0 && kill((pid_t)child, 0) == 0)
+                tid_set_add((pid_t)child);
+            // 非主线程 exec 时接管主线程的 tid 原来的 tid 消失 不会再有退出通知
+            unsigned long former;
+            if (event == PTRACE_EVENT_EXEC && ptrace(PTRACE_GETEVENTMSG, tid, 0, &former) == 0 &&
+                (pid_t)former != tid)
+                tid_set_remove((pid_t)former);
+            if (event == PTRACE_EVENT_EXEC && stack_nodes != NULL)
+                forget_maps(tid);
+        }
+        else
+        {
+            inject = sig;
+        }
+        ptrace(PTRACE_SYSCALL, tid, 0, inject);
+    }
+    return 0;
+}
+
+static void ptrace_finish(syscall_stats *stats)
+{
+    // 附加模式下结束时放开仍在运行的线程
+    if (!ptrace_is_child && ptrace_target > 0)
+    {
+        for (int i = 0; i < PERF_TID_SLOTS; i++)
+        {
+            if (ptrace_tids[i] != 0)
+                ptrace(PTRACE_DETACH, ptrace_tids[i], 0, 0);
+        }
+    }
+    while (waitpid(-1, NULL, __WALL | WNOHANG) > 0)
+        ;
+    close(ptrace_sigfd);
+
+    // 恢复 SIGCHLD 之后启动的子进程不再继承被屏蔽的掩码
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+}
+
+static const trace_backend backends[] = {
+    {"strace", -1, strace_start, strace_pollfds, strace_process, strace_finish},
+    {"perf", 100, perf_start, perf_pollfds, perf_process, perf_finish},
+    {"ptrace", 10, ptrace_start, ptrace_pollfds, ptrace_process, ptrace_finish},
+};
+
+// ======================== 报告与事件循环 ========================
+
+static output_stream out;   // 流式输出
+static syscall_stats prev;  // 上一次流式输出时的统计
+static syscall_stats fd_prev; // 上一次流式输出时的 fd 统计
+static int streaming;       // 是否输出 json/binary 流
+static int interactive;     // 是否输出交互式报告
+
+/**
+ * @brief 输出一次报告
+ * @param void
+ * @return void
+ * @note 根据模式输出交互式报告和/或流式增量
+ */
+static void report(void)
+{
+    if (interactive)
+        print_top_syscalls(&stats, fd_live ? &fd_live->stats : NULL);
+    if (streaming)
+    {
+        double ts = elapsed_seconds();
+        output_interval(&out, &stats, &prev, ts, SPERF_KIND_SYSCALL);
+        if (fd_live != NULL)
+            output_interval(&out, &fd_live->stats, &fd_prev, ts, SPERF_KIND_FD);
+        output_flush(&out);
+    }
+}
+
+/**
+ * @brief 用指定后端跟踪并定时报告
+ * @param be 跟踪后端
+ * @param cmd_argv 被跟踪的命令
+ * @param pid 要附加的进程 0 表示运行 cmd_argv
+ * @return 0 on success, -1 on failure
+ * @note 后端的数据、定时器和输出流都通过 poll 等待
+ *       报告只在两次处理之间输出 不会打断正在进行的更新
+ */
+static int run_backend(const trace_backend *be, char **cmd_argv, pid_t pid)
+{
+    if (be->start(cmd_argv, pid) != 0)
+        return -1;
+
+    // 父进程：设置定时器并读取跟踪数据
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    int tfd = setup_timer();
+    if (tfd == -1)
+    {
+        be->finish(&stats);
+        return -1;
+    }
+
+    static struct pollfd fds[MAX_POLLFDS];
+    while (1)
+    {
+        // 输出流有积压时才关心它是否可写
+        fds[0] = (struct pollfd){.fd = tfd, .events = POLLIN};
+        fds[1] = (struct pollfd){.fd = streaming && out.len > 0 ? out.fd : -1, .events = POLLOUT};
+        int n = be->pollfds(fds + 2, MAX_POLLFDS - 2);
+
+        int r = poll(fds, n + 2, be->timeout_ms);
+        if (r == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+
+        // 处理跟踪数据 超时也处理一次 供按时轮询的后端使用
+        int ready = r == 0;
+        for (int i = 2; i < n + 2; i++)
+            ready |= fds[i].revents != 0;
+        if (ready && be->process(&stats))
+            break;
+
+        // 定时器到期 输出报告
+        if (fds[0].revents & POLLIN)
+        {
+            uint64_t expirations;
+            if (read(tfd, &expirations, sizeof(expirations)) == sizeof(expirations))
+                report();
+        }
+
+        // 输出流可写 继续写出积压的数据
+        if (fds[1].revents & (POLLOUT | POLLERR))
+            output_flush(&out);
+    }
+
+    close(tfd);
+    be->finish(&stats);
+    return 0;
+}
+
+// ======================== 开销校准 ========================
+
+// 合成负载 分别代表廉价调用、小块 I/O 和阻塞调用
+static const calib_workload workloads[] = {
+    {"getpid", 10000, 1, {"getpid", NULL}},
+    {"rw", 5000, 2, {"read", "write"}},
+    {"sleep", 50, 1, {"clock_nanosleep", NULL}},
+};
+
+/**
+ * @brief 在当前进程中运行一个合成负载
+ * @param w 负载
+ * @param ops 操作次数
+ * @return 每次操作的平均耗时 单位 ns 失败时返回-1
+ * @note 既用于不跟踪时的基线 也是被跟踪的目标进程实际执行的代码
+ */
+static double calib_run(const calib_workload *w, long ops)
+{
+    int in = -1, outfd = -1;
+    if (strcmp(w->name, "rw") == 0)
+    {
+        in = open("/dev/zero", O_RDONLY);
+        outfd = open("/dev/null", O_WRONLY);
+        if (in == -1 || outfd == -1)
+            return -1;
+    }
+
+    char buf[64];
+    struct timespec nap = {.tv_sec = 0, .tv_nsec = 1000000};
+    uint64_t begin = monotonic_ns();
+    for (long i = 0; i < ops; i++)
+    {
+        if (in != -1)
+        {
+            read(in, buf, sizeof(buf));
+            write(outfd, buf, sizeof(buf));
+        }
+        else if (strcmp(w->name, "sleep") == 0)
+            clock_nanosleep(CLOCK_MONOTONIC, 0, &nap, NULL);
+        else
+            syscall(SYS_getpid); // 绕过 libc 可能的缓存
+    }
+    double ns = (double)(monotonic_ns() - begin) / ops;
+
+    if (in != -1)
+    {
+        close(in);
+        close(outfd);
+    }
+    return ns;
+}
+
+/**
+ * @brief 作为被跟踪的目标运行负载 --calibrate-target=NAME:OPS:FD
+ * @param spec 负载名、操作次数和结果 fd
+ * @return 进程退出码
+ * @note 在目标进程内计时 得到的是它被跟踪时实际感受到的速度 结果以文本写到 FD
+ */
+static int calib_target(const char *spec)
+{
+    char name[32];
+    long ops;
+    int fd;
+    if (sscanf(spec, "%31[^:]:%ld:%d", name, &ops, &fd) != 3 || ops <= 0)
+    {
+        fprintf(stderr, "Invalid calibration target: %s\n", spec);
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+    {
+        if (strcmp(name, workloads[i].name) == 0)
+        {
+            double ns = calib_run(&workloads[i], ops);
+            if (ns < 0)
+                return 1;
+            dprintf(fd, "%.1f\n", ns);
+            return 0;
+        }
+    }
+    fprintf(stderr, "Unknown workload: %s\n", name);
+    return 1;
+}
+
+/**
+ * @brief 用指定后端跟踪一次合成负载
+ * @param be 跟踪后端
+ * @param w 负载
+ * @param ops 操作次数
+ * @param traced_ns 结果：目标进程内测得的每次操作耗时
+ * @param reported_ns 结果：后端报告的负载系统调用的平均耗时
+ * @return 0 on success, -1 on failure
+ * @note 目标就是 sperf 自身 以 --calibrate-target 重新执行 结果经继承的管道传回
+ *       会覆盖全局统计 只能在正式跟踪之前调用
+ */
+static int calib_traced(const trace_backend *be, const calib_workload *w, long ops,
+                        double *traced_ns, double *reported_ns)
+{
+    // strace 会按 PATH 重新查找命令 必须给出绝对路径
+    char self[4096];
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len <= 0)
+        return -1;
+    self[len] = '\0';
+
+    int result[2];
+    if (pipe(result) == -1)
+        return -1;
+    fcntl(result[0], F_SETFD, FD_CLOEXEC);
+    char spec[96];
+    snprintf(spec, sizeof(spec), "--calibrate-target=%s:%ld:%d", w->name, ops, result[1]);
+    char *cmd_argv[] = {self, spec, NULL};
+
+    memset(&stats, 0, sizeof(stats));
+    int ret = run_backend(be, cmd_argv, 0);
+    close(result[1]);
+    char buf[64];
+    ssize_t n = read(result[0], buf, sizeof(buf) - 1);
+    close(result[0]);
+    if (ret != 0 || n <= 0)
+        return -1;
+    buf[n] = '\0';
+    *traced_ns = atof(buf);
+
+    double time = 0;
+    unsigned long count = 0;
+    for (int i = 0; i < 2 && w->syscalls[i] != NULL; i++)
+    {
+        int k = stat_find(&stats, w->syscalls[i], strlen(w->syscalls[i]));
+        if (k >= 0)
+        {
+            time += stats.stats[k].total_time;
+            count += stats.stats[k].count;
+        }
+    }
+    if (count == 0)
+        return -1;
+    *reported_ns = time / count * 1e9;
+    return 0;
+}
+
+/**
+ * @brief 运行校准套件 对每个后端和负载输出开销表
+ * @param void
+ * @return 0 on success, -1 没有任何后端可用
+ * @note overhead 是被跟踪程序每次系统调用变慢的时间
+ *       bias 是报告的耗时比真实耗时多出的部分 --correct 扣除的就是它
+ */
+static int calibrate(void)
+{
+    printf("%-8s %-8s %12s %12s %9s %16s %16s %12s\n", "backend", "workload", "base ns/op",
+           "traced ns/op", "slowdown", "overhead ns/call", "reported ns/call", "bias ns/call");
+    int ok = 0;
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++)
+    {
+        for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+        {
+            const calib_workload *w = &workloads[i];
+            double base = calib_run(w, w->ops);
+            double traced, reported;
+            if (calib_traced(&backends[b], w, w->ops, &traced, &reported) != 0)
+            {
+                printf("%-8s %-8s %12s\n", backends[b].name, w->name, "unavailable");
+                fflush(stdout);
+                break;
+            }
+            double actual = base / w->calls;
+            printf("%-8s %-8s %12.0f %12.0f %8.1fx %16.0f %16.0f %12.0f\n", backends[b].name,
+                   w->name, base, traced, traced / base, (traced - base) / w->calls, reported,
+                   reported - actual);
+            fflush(stdout);
+            ok = 1;
+        }
+    }
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief 测出后端计入每次调用的额外耗时 之后记录的耗时都扣除它
+ * @param be 跟踪后端
+ * @return 0 on success, -1 on failure
+ * @note 以 getpid 为准 它本身的耗时可以在不跟踪时精确测得
+ */
+static int calibrate_bias(const trace_backend *be)
+{
+    const calib_workload *w = &workloads[0];
+    double base = calib_run(w, CORRECT_OPS);
+    double traced, reported;
+    if (calib_traced(be, w, CORRECT_OPS, &traced, &reported) != 0)
+    {
+        fprintf(stderr, "sperf: calibration of the %s backend failed\n", be->name);
+        return -1;
+    }
+    double bias = reported - base;
+    time_bias = bias > 0 ? bias / 1e9 : 0;
+    fprintf(stderr, "sperf: %s backend adds %.0f ns per call, subtracting it\n", be->name,
+            time_bias * 1e9);
+    memset(&stats, 0, sizeof(stats));
+    return 0;
+}
+
+// ======================== 运行对比 ========================
+
+/**
+ * @brief 在一行 JSON 中找到某个键的值
+ * @param line JSON 行
+ * @param key 键名 含引号和冒号 如 "\"count\":"
+ * @return 值的起始位置 找不到时返回NULL
+ * @note 只用于 sperf 自己输出的扁平对象
+ */
+static const char *json_field(const char *line, const char *key)
+{
+    const char *p = strstr(line, key);
+    return p ? p + strlen(key) : NULL;
+}
+
+/**
+ * @brief 读取 JSON Lines 报告 累加所有区间的系统调用统计
+ * @param fp 已打开的文件
+ * @param out 结果
+ * @return 0 on success, -1 on failure
+ * @note fd 记录被跳过 旧版本没有 hist 字段的报告只有次数和总耗时
+ */
+static int load_json_report(FILE *fp, syscall_stats *out)
+{
+    char *line = NULL;
+    size_t cap = 0;
+    while (getline(&line, &cap, fp) != -1)
+    {
+        const char *name = json_field(line, "\"syscall\":\"");
+        const char *count = json_field(line, "\"count\":");
+        const char *total = json_field(line, "\"total_time\":");
+        if (name == NULL || count == NULL || total == NULL)
+            continue;
+        const char *end = strchr(name, '"');
+        if (end == NULL)
+            continue;
+
+        syscall_stat *st = stat_lookup(out, name, end - name);
+        if (st == NULL)
+            continue;
+        double time = strtod(total, NULL);
+        st->count += strtoul(count, NULL, 10);
+        st->total_time += time;
+        out->total_time += time;
+
+        // "hist":{"12":3,"13":40}
+        const char *h = json_field(line, "\"hist\":{");
+        while (h != NULL && *h == '"')
+        {
+            char *q;
+            long b = strtol(h + 1, &q, 10);
+            if (q[0] != '"' || q[1] != ':' || b < 0 || b >= HIST_BUCKETS)
+                break;
+            st->hist[b] += strtoull(q + 2, &q, 10);
+            h = *q == ',' ? q + 1 : NULL;
+        }
+    }
+    free(line);
+    return 0;
+}
+
+/**
+ * @brief 读取二进制流报告
+ * @param fp 已打开的文件 已读过流头
+ * @param out 结果
+ * @return 0 on success, -1 on failure
+ * @note 各区间的直方图逐桶累加 与 JSON 流一样可做显著性检验
+ */
+static int load_binary_report(FILE *fp, syscall_stats *out)
+{
+    sperf_record rec;
+    char name[256];
+    sperf_hist_entry entries[256];
+    while (fread(&rec, sizeof(rec), 1, fp) == 1)
+    {
+        if (fread(name, 1, rec.name_len, fp) != rec.name_len ||
+            fread(entries, sizeof(entries[0]), rec.hist_len, fp) != rec.hist_len)
+            return -1;
+        if (rec.kind != SPERF_KIND_SYSCALL)
+            continue;
+        syscall_stat *st = stat_lookup(out, name, rec.name_len);
+        if (st == NULL)
+            continue;
+        st->count += rec.count;
+        st->total_time += rec.total_ns / 1e9;
+        out->total_time += rec.total_ns / 1e9;
+        for (int i = 0; i < rec.hist_len; i++)
+        {
+            if (entries[i].bucket < HIST_BUCKETS)
+                st->hist[entries[i].bucket] += entries[i].count;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 读取一份保存下来的报告
+ * @param path 文件路径
+ * @param out 结果
+ * @return 0 on success, -1 on failure
+ * @note 按内容识别格式：二进制流、JSON Lines 流 其余按 strace -T 日志离线解析
+ */
+int load_report(const char *path, syscall_stats *out)
+{
+    memset(out, 0, sizeof(*out));
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    sperf_stream_header hdr;
+    size_t n = fread(&hdr, 1, sizeof(hdr), fp);
+    int ret;
+    if (n == sizeof(hdr) && memcmp(hdr.magic, SPERF_MAGIC, sizeof(hdr.magic)) == 0)
+    {
+        if (hdr.byte_order != 0x0102)
+        {
+            fprintf(stderr, "%s: written with a different byte order\n", path);
+            ret = -1;
+        }
+        else if (hdr.version != SPERF_VERSION)
+        {
+            // 旧版本的记录不带直方图 比较结果会缺少检验 直接拒绝
+            fprintf(stderr, "%s: stream version %d is not supported (expected %d); record it again\n",
+                    path, hdr.version, SPERF_VERSION);
+            ret = -1;
+        }
+        else
+            ret = load_binary_report(fp, out);
+    }
+    else if (n > 0 && ((const char *)&hdr)[0] == '{')
+    {
+        rewind(fp);
+        ret = load_json_report(fp, out);
+    }
+    else
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        ret = analyze_trace_files(&path, 1, out, NULL);
+    }
+    fclose(fp);
+    return ret;
+}
+
+/**
+ * @brief 按直方图比较两组耗时 Mann-Whitney U 检验
+ * @param a 第一组的直方图
+ * @param b 第二组的直方图
+ * @return z 值 正数表示 b 更慢 任一组为空时返回0
+ * @note 同一个桶内的样本视为相等 用平均秩并做结的校正
+ */
+double hist_shift_z(const uint64_t *a, const uint64_t *b)
+{
+    double n1 = 0, n2 = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        n1 += a[i];
+        n2 += b[i];
+    }
+    double n = n1 + n2;
+    if (n1 == 0 || n2 == 0)
+        return 0;
+
+    double rank = 0, r2 = 0, ties = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        double t = (double)a[i] + b[i];
+        if (t == 0)
+            continue;
+        r2 += b[i] * (rank + (t + 1) / 2);
+        ties += t * t * t - t;
+        rank += t;
+    }
+    double u = r2 - n2 * (n2 + 1) / 2;
+    double var = n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1)));
+    return var > 0 ? (u - n1 * n2 / 2) / sqrt(var) : 0;
+}
+
+// 对比表中的一行
+typedef struct
+{
+    const syscall_stat *a, *b;
+    double delta; // 总耗时的变化 用于排序
+} diff_row;
+
+static int diff_cmp(const void *x, const void *y)
+{
+    double dx = fabs(((const diff_row *)x)->delta);
+    double dy = fabs(((const diff_row *)y)->delta);
+    return (dx < dy) - (dx > dy);
+}
+
+/**
+ * @brief 逐个系统调用输出两次运行的差异
+ * @param a 基准运行
+ * @param b 新的运行
+ * @return void
+ * @note 按总耗时变化从大到小排列 只在一边出现的标为 new / gone
+ *       sig 栏：*  |z|>=1.96  ** |z|>=2.58  *** |z|>=3.29 (双侧 p<0.05/0.01/0.001)
+ */
+void print_diff(const syscall_stats *a, const syscall_stats *b)
+{
+    static diff_row rows[2 * MAX_SYSCALLS];
+    int n = 0;
+    for (int i = 0; i < a->count; i++)
+    {
+        int k = stat_find(b, a->stats[i].name, strlen(a->stats[i].name));
+        rows[n].a = &a->stats[i];
+        rows[n].b = k >= 0 ? &b->stats[k] : NULL;
+        n++;
+    }
+    for (int i = 0; i < b->count; i++)
+    {
+        if (stat_find(a, b->stats[i].name, strlen(b->stats[i].name)) < 0)
+            rows[n++] = (diff_row){.a = NULL, .b = &b->stats[i]};
+    }
+    for (int i = 0; i < n; i++)
+        rows[i].delta = (rows[i].b ? rows[i].b->total_time : 0) -
+                        (rows[i].a ? rows[i].a->total_time : 0);
+    qsort(rows, n, sizeof(diff_row), diff_cmp);
+
+    printf("%-20s %10s %10s %8s %11s %11s %8s %7s\n", "syscall", "count A", "count B",
+           "delta", "mean A(us)", "mean B(us)", "delta", "z");
+    for (int i = 0; i < n; i++)
+    {
+        const syscall_stat *sa = rows[i].a, *sb = rows[i].b;
+        const char *name = sa ? sa->name : sb->name;
+        unsigned long ca = sa ? sa->count : 0, cb = sb ? sb->count : 0;
+        double ma = ca ? sa->total_time / ca * 1e6 : 0;
+        double mb = cb ? sb->total_time / cb * 1e6 : 0;
+
+        if (sa == NULL || sb == NULL)
+        {
+            printf("%-20s %10lu %10lu %8s %11.2f %11.2f %8s %7s  %s\n", name, ca, cb, "",
+                   ma, mb, "", "", sa == NULL ? "new" : "gone");
+            continue;
+        }
+
+        // 直方图为空时无法检验
+        uint64_t ha = 0, hb = 0;
+        for (int k = 0; k < HIST_BUCKETS; k++)
+        {
+            ha += sa->hist[k];
+            hb += sb->hist[k];
+        }
+        double z = hist_shift_z(sa->hist, sb->hist);
+        const char *sig = fabs(z) >= 3.29 ? "***" : fabs(z) >= 2.58 ? "**" : fabs(z) >= 1.96 ? "*" : "";
+        char dc[16], dm[16], zs[16];
+        snprintf(dc, sizeof(dc), "%+.0f%%", ca ? ((double)cb - ca) * 100 / ca : 0);
+        snprintf(dm, sizeof(dm), "%+.0f%%", ma > 0 ? (mb - ma) * 100 / ma : 0);
+        snprintf(zs, sizeof(zs), ha && hb ? "%+.2f" : "n/a", z);
+        printf("%-20s %10lu %10lu %8s %11.2f %11.2f %8s %7s  %s\n", name, ca, cb, dc,
+               ma, mb, dm, zs, sig);
+    }
+}
+
+/**
+ * @brief 用选定的后端依次运行两条命令 然后输出差异
+ * @param be 跟踪后端
+ * @param cmd_a 基准命令 交给 /bin/sh -c 执行
+ * @param cmd_b 新的命令
+ * @return 0 on success, -1 on failure
+ * @note 两次运行共用全局统计 先把第一次的结果拷出来
+ */
+static int diff_commands(const trace_backend *be, const char *cmd_a, const char *cmd_b)
+{
+    static syscall_stats first;
+    const char *cmds[2] = {cmd_a, cmd_b};
+    for (int i = 0; i < 2; i++)
+    {
+        char *cmd_argv[] = {"/bin/sh", "-c", (char *)cmds[i], NULL};
+        memset(&stats, 0, sizeof(stats));
+        if (run_backend(be, cmd_argv, 0) != 0)
+            return -1;
+        if (i == 0)
+            memcpy(&first, &stats, sizeof(first));
+    }
+    print_diff(&first, &stats);
+    return 0;
+}
+
+void printUsage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options] <command> [args...]\n", prog);
+    fprintf(stderr, "       %s [options] -p PID\n", prog);
+    fprintf(stderr, "       %s [options] --input=FILE...\n", prog);
+    fprintf(stderr, "       %s [options] --diff A B | --diff-run 'CMD A' 'CMD B'\n", prog);
+    fprintf(stderr, "  -b, --backend=NAME         tracing backend (default: strace)\n");
+    fprintf(stderr, "                             strace: parse 'strace -T' output\n");
+    fprintf(stderr, "                             perf:   raw_syscalls tracepoints, no ptrace stops\n");
+    fprintf(stderr, "                             ptrace: native ptrace, supports --stacks\n");
+    fprintf(stderr, "  -p, --pid=PID              trace an already running process\n");
+    fprintf(stderr, "  -d, --fds                  also break down read/write/send/recv/fsync time by file\n");
+    fprintf(stderr, "  -s, --stacks=FILE          attribute syscall time to user call stacks (frame pointers)\n");
+    fprintf(stderr, "                             and write them to FILE in collapsed (flame graph) format\n");
+    fprintf(stderr, "  --calibrate                measure the tracing overhead of every backend on\n");
+    fprintf(stderr, "                             synthetic getpid / read+write / sleep workloads\n");
+    fprintf(stderr, "  --correct                  calibrate the selected backend first and subtract\n");
+    fprintf(stderr, "                             its per-call bias from every reported time\n");
+    fprintf(stderr, "  --diff A B                 compare two saved reports syscall by syscall\n");
+    fprintf(stderr, "                             (json/binary streams or strace -T logs)\n");
+    fprintf(stderr, "  --diff-run 'CMD A' 'CMD B' trace two shell commands in turn and compare them\n");
+    fprintf(stderr, "  --format=text|json|binary  output format (default: text)\n");
+    fprintf(stderr, "  -o, --output=FILE          write json/binary stream to FILE ('-' for stdout)\n");
+    fprintf(stderr, "  --output-fd=N              write json/binary stream to fd N\n");
+    fprintf(stderr, "  -i, --input=FILE           analyze a saved 'strace -T -o FILE' trace instead\n");
+    fprintf(stderr, "                             (FILE.PID files from 'strace -ff' are included)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    output_format format = FORMAT_TEXT;
+    const trace_backend *backend = &backends[0];
+    const char *output_path = NULL;
+    int output_fd = -1;
+    pid_t pid = 0;
+    int opt;
+    int long_index = 0;
+    static struct option long_options[] = {
+        {"format", required_argument, 0, 'f'},
+        {"output", required_argument, 0, 'o'},
+        {"output-fd", required_argument, 0, 'F'},
+        {"input", required_argument, 0, 'i'},
+        {"backend", required_argument, 0, 'b'},
+        {"pid", required_argument, 0, 'p'},
+        {"fds", no_argument, 0, 'd'},
+        {"stacks", required_argument, 0, 's'},
+        {"calibrate", no_argument, 0, 'C'},
+        {"correct", no_argument, 0, 'K'},
+        {"calibrate-target", required_argument, 0, 'T'},
+        {"diff", no_argument, 0, 'D'},
+        {"diff-run", no_argument, 0, 'R'},
+        {0, 0, 0, 0}};
+    int track_fds = 0;
+    int run_calibration = 0;
+    int correct = 0;
+    int diff_mode = 0; // 'D' 对比两份报告 'R' 对比两条命令
+    const char *stacks_path = NULL;
+    static const char *inputs[MAX_INPUTS];
+    int ninputs = 0;
+
+    // '+' 遇到第一个非选项参数即停止 之后都属于被跟踪的命令
+    while ((opt = getopt_long(argc, argv, "+o:i:b:p:ds:", long_options, &long_index)) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            if (strcmp(optarg, "text") == 0)
+                format = FORMAT_TEXT;
+            else if (strcmp(optarg, "json") == 0)
+                format = FORMAT_JSON;
+            else if (strcmp(optarg, "binary") == 0)
+                format = FORMAT_BINARY;
+            else
+            {
+                fprintf(stderr, "Unknown format: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        case 'F':
+            output_fd = atoi(optarg);
+            break;
+        case 'i':
+            if (ninputs < MAX_INPUTS)
+                inputs[ninputs++] = optarg;
+            break;
+        case 'b':
+            backend = NULL;
+            for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+            {
+                if (strcmp(optarg, backends[i].name) == 0)
+                    backend = &backends[i];
+            }
+            if (backend == NULL)
+            {
+                fprintf(stderr, "Unknown backend: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'p':
+            pid = atoi(optarg);
+            if (pid <= 0)
+            {
+                fprintf(stderr, "Invalid pid: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'd':
+            track_fds = 1;
+            break;
+        case 's':
+            stacks_path = optarg;
+            break;
+        case 'C':
+            run_calibration = 1;
+            break;
+        case 'K':
+            correct = 1;
+            break;
+        case 'T':
+            // 校准时被跟踪的目标 由 sperf 自己以此参数重新执行
+            return calib_target(optarg);
+        case 'D':
+        case 'R':
+            diff_mode = opt;
+            break;
+        default:
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (run_calibration)
+        return calibrate() == 0 ? 0 : 1;
+
+    if (diff_mode != 0)
+    {
+        if (argc - optind != 2)
+        {
+            fprintf(stderr, "--diff and --diff-run take exactly two arguments\n");
+            return 1;
+        }
+        if (correct && calibrate_bias(backend) != 0)
+            return 1;
+        if (diff_mode == 'R')
+            return diff_commands(backend, argv[optind], argv[optind + 1]) == 0 ? 0 : 1;
+
+        static syscall_stats a, b;
+        if (load_report(argv[optind], &a) != 0 || load_report(argv[optind + 1], &b) != 0)
+            return 1;
+        print_diff(&a, &b);
+        return 0;
+    }
+
+    // 命令行参数检查
+    if (optind >= argc && ninputs == 0 && pid == 0)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+    char **cmd_argv = argv + optind;
+    if (stacks_path != NULL && (ninputs > 0 || strcmp(backend->name, "ptrace") != 0))
+    {
+        fprintf(stderr, "--stacks requires --backend=ptrace\n");
+        return 1;
+    }
+
+    // 校准要运行一次合成负载 须在输出流和其他统计初始化之前完成
+    if (correct && calibrate_bias(backend) != 0)
+        return 1;
+
+    // 流式输出 未指定目标时写到标准输出
+    streaming = format != FORMAT_TEXT;
+    if (streaming)
+    {
+        if (output_path == NULL && output_fd == -1)
+            output_path = "-";
+        if (output_open(&out, output_path, output_fd, format) != 0)
+            return 1;
+    }
+    // 流写到标准输出时不再输出交互式报告
+    interactive = !streaming || out.fd != STDOUT_FILENO;
+
+    // 初始化系统调用统计信息
+    memset(&stats, 0, sizeof(stats));
+    if (track_fds)
+    {
+        fd_live = malloc(sizeof(fd_tracker));
+        fd_tracker_init(fd_live);
+    }
+    if (stacks_path != NULL && stack_init() != 0)
+        return 1;
+
+    if (ninputs > 0)
+    {
+        // 离线模式：分析已保存的 trace 文件
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        if (analyze_trace_files(inputs, ninputs, &stats, fd_live) != 0)
+            return 1;
+    }
+    else if (run_backend(backend, cmd_argv, pid) != 0)
+    {
+        return 1;
+    }
+
+    // 打印信息
+    report();
+    if (streaming)
+        output_close(&out);
+    if (stacks_path != NULL && stack_dump(stacks_path, &stats) != 0)
+        return 1;
+    return 0;
+}
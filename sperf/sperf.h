@@ -0,0 +1,210 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <poll.h>
+#include <sys/types.h>
+
+#define MAX_SYSCALLS 1024         // 最大系统调用数
+#define STAT_INDEX_SIZE 2048      // 名称索引大小 2的幂 不小于 2*MAX_SYSCALLS
+#define TOP_N 5                   // 输出前TOP_N个系统调用
+#define INTERVAL_MS 1000          // 1000ms更新
+#define MAX_LINE 8192             // 单行strace输出的最大长度
+#define REPORT_SIZE 8192          // 一次报告的输出缓冲区大小
+#define HIST_BUCKETS 40           // 耗时直方图桶数 第i个桶为 [2^(i-1), 2^i) ns
+#define OUT_BUFFER_SIZE (1 << 20) // 流式输出缓冲区大小
+#define CHUNK_SIZE (4 << 20)      // 离线解析时每个分块的大小
+#define MAX_INPUTS 4096           // 离线解析的最大文件数（含 -ff 的各个 PID 文件）
+#define MAX_POLLFDS 1024          // 事件循环最多等待的 fd 数
+#define PERF_RING_PAGES 512       // perf 后端每个 CPU 的环形缓冲区页数 须为2的幂
+#define PERF_TID_SLOTS 65536      // perf 后端按 tid 记录未返回调用的槽数 须为2的幂
+#define PERF_MAX_TASKS 4096       // -p 附加时最多跟踪的线程数
+#define PROC_FD_CACHE 4096        // (pid, fd) -> 路径缓存的槽数 须为2的幂
+#define FD_BINDINGS 16384         // 按 fd 统计时 (pid, fd) -> 路径表的槽数 须为2的幂
+#define FD_OTHER "[other]"        // 路径表满后归入的统计项
+#define FD_UNKNOWN "[unknown]"    // 找不到对应 <unfinished ...> 行的续行归入的统计项
+#define FD_PENDING 256            // 按 pid 记录未完成 I/O 调用的槽数 须为2的幂
+#define PTRACE_BATCH 4096         // ptrace 后端每轮最多处理的停止次数
+#define STACK_NODES (1 << 18)     // 调用栈前缀树的节点上限
+#define STACK_INDEX_SIZE (1 << 19) // 前缀树索引大小 2的幂 不小于 2*STACK_NODES
+#define STACK_DEPTH 64            // 回溯的最大帧数
+#define STACK_MAX_FRAME (1 << 20) // 相邻两帧之间的最大距离 超过视为帧指针无效
+#define STACK_TOP_N 2             // 报告中每个系统调用列出的调用栈数
+#define STACK_SHOW_FRAMES 3       // 报告中每个调用栈显示的帧数
+#define MAX_MODULES 1024          // 调用栈中模块名的上限
+#define MAX_MAPS 512              // 每个进程缓存的可执行映射数
+#define MAPS_CACHE 64             // 映射缓存的进程槽数 须为2的幂
+#define CORRECT_OPS 2000          // --correct 启动前校准时的 getpid 次数
+
+// 输出格式
+typedef enum
+{
+    FORMAT_TEXT,   // 交互式报告
+    FORMAT_JSON,   // JSON Lines 每个区间每种系统调用一行
+    FORMAT_BINARY, // 紧凑的二进制记录流
+} output_format;
+
+// 一种系统调用的统计信息
+typedef struct
+{
+    char name[64];
+    double total_time;
+    unsigned long count;
+    uint64_t hist[HIST_BUCKETS];
+} syscall_stat;
+
+// 所有系统调用统计信息
+typedef struct
+{
+    syscall_stat stats[MAX_SYSCALLS];
+    int count;
+    double total_time;
+    uint16_t index[STAT_INDEX_SIZE]; // 名称哈希索引 存 下标+1 0表示空
+} syscall_stats;
+
+// 按文件描述符统计的 I/O 耗时
+// 路径直接驻留在 stats 的名字表中 与系统调用表共用同一套结构和索引
+// 表的大小有上限 溢出的路径归到 FD_OTHER
+// strace -f 把被打断的调用拆成 <unfinished ...> 和 <... resumed> 两行
+// 前一行有 fd 后一行有耗时 pending 按 pid 暂存前一行的 fd
+typedef struct
+{
+    int key;  // pid+1 0表示空槽
+    int fd;
+    int slot; // -y 给出路径时的统计项下标 否则为-1
+} fd_pending;
+
+// 不同进程的 fd 号互不相干 open 建立的绑定按 (pid, fd) 区分
+// -ff 的各个文件没有 pid 前缀 每个分块开始时清空 只在分块内关联
+typedef struct
+{
+    int key;  // pid+1 0表示空槽
+    int fd;
+    int slot; // 路径的统计项下标 fd 关闭后为-1
+} fd_binding;
+
+typedef struct
+{
+    syscall_stats stats;
+    fd_binding bind[FD_BINDINGS];
+    int bind_count; // 已用的槽数 用到四分之三后不再建立新的绑定
+    fd_pending pending[FD_PENDING];
+} fd_tracker;
+
+// 调用栈前缀树的节点
+// 从根到某个节点的路径是一条由外到内的调用栈 叶子是系统调用
+#define STACK_SYSCALL 0xffffffffu // module 取此值时 offset 是系统调用统计项下标
+
+typedef struct
+{
+    uint32_t parent;     // 父节点 0是根
+    uint32_t module;     // 帧所在的模块
+    uint64_t offset;     // 模块内的文件偏移
+    double time;         // 叶子：该调用栈上此系统调用的总耗时
+    unsigned long count; // 叶子：调用次数
+} stack_node;
+
+// 二进制流格式
+// 流开头是一个 sperf_stream_header 之后是若干条 sperf_record
+// 每条记录后紧跟 name_len 字节的系统调用名（不含结尾\0）
+// 再跟 hist_len 个 sperf_hist_entry 只列非空的桶 供 --diff 做显著性检验
+// 所有整数均为主机字节序 由 header 中的 byte_order 标明
+#define SPERF_MAGIC "SPERF"
+#define SPERF_VERSION 3
+
+typedef struct __attribute__((packed))
+{
+    char magic[5];      // "SPERF"
+    uint8_t version;    // SPERF_VERSION
+    uint16_t byte_order; // 写入 0x0102 读取方据此判断字节序
+} sperf_stream_header;
+
+#define SPERF_KIND_SYSCALL 0 // name 为系统调用名
+#define SPERF_KIND_FD 1      // name 为文件路径
+
+typedef struct __attribute__((packed))
+{
+    uint64_t ts_ns;    // 区间结束时刻 相对跟踪开始
+    uint64_t total_ns; // 区间内总耗时
+    uint64_t p50_ns;   // 区间内耗时分位数
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint32_t count;    // 区间内调用次数
+    uint8_t kind;      // SPERF_KIND_SYSCALL 或 SPERF_KIND_FD
+    uint8_t name_len;  // 紧随其后的名字长度
+    uint8_t hist_len;  // 名字之后的直方图桶数
+} sperf_record;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t bucket; // 桶下标 含义同 HIST_BUCKETS
+    uint32_t count; // 区间内落在该桶的次数
+} sperf_hist_entry;
+
+// 流式输出 写到缓冲区 由事件循环在 fd 可写时刷出
+typedef struct
+{
+    int fd;
+    output_format format;
+    char *buf;
+    size_t len;
+    size_t write_max;      // 每次 write 的上限 管道和套接字为 PIPE_BUF
+    unsigned long dropped; // 缓冲区满时丢弃的区间数
+} output_stream;
+
+// 离线解析的一个分块 起止都在行边界上
+typedef struct
+{
+    const char *data;
+    size_t len;
+} trace_chunk;
+
+// 校准用的合成负载 调用次数和每次的系统调用已知
+typedef struct
+{
+    const char *name;         // 负载名
+    long ops;                 // --calibrate 时的操作次数
+    int calls;                // 每次操作的系统调用数
+    const char *syscalls[2];  // 报告中对应的系统调用名
+} calib_workload;
+
+// 跟踪后端 由事件循环驱动
+typedef struct
+{
+    const char *name;
+    int timeout_ms;                                // poll 超时 -1 表示只在 fd 就绪时处理
+    int (*start)(char **cmd_argv, pid_t pid);      // 运行命令或附加到 pid
+    int (*pollfds)(struct pollfd *fds, int max);   // 需要等待的 fd
+    int (*process)(syscall_stats *stats);          // 处理数据 目标结束时返回1
+    void (*finish)(syscall_stats *stats);          // 收尾并回收子进程
+} trace_backend;
+
+int stat_find(const syscall_stats *stats, const char *name, size_t len);
+syscall_stat *stat_lookup(syscall_stats *stats, const char *name, size_t len);
+void stat_record(syscall_stats *stats, const char *name, size_t len, double time);
+void stats_merge(syscall_stats *dst, const syscall_stats *src);
+void fd_tracker_init(fd_tracker *fds);
+int fd_intern(fd_tracker *fds, const char *path, size_t len);
+void fd_tracker_reset(fd_tracker *fds);
+void fd_record(fd_tracker *fds, int pid, int fd, int slot, double time);
+void fd_bind(fd_tracker *fds, int pid, int fd, int slot);
+int is_fd_syscall(const char *name, size_t len);
+void parse_strace_record(const char *line, size_t len, syscall_stats *stats,
+                         fd_tracker *fds);
+void parse_strace_line(const char *line, syscall_stats *stats, fd_tracker *fds);
+double stat_percentile(const uint64_t *hist, unsigned long count, double p);
+void print_top_syscalls(const syscall_stats *stats, const syscall_stats *fd_stats);
+int output_open(output_stream *out, const char *path, int fd, output_format format);
+void output_interval(output_stream *out, const syscall_stats *cur,
+                     syscall_stats *prev, double ts, int kind);
+int output_flush(output_stream *out);
+void output_close(output_stream *out);
+int setup_timer(void);
+int stack_init(void);
+uint32_t stack_intern(uint32_t parent, uint32_t module, uint64_t offset);
+void stack_record(uint32_t stack, int stat, double time);
+int stack_dump(const char *path, const syscall_stats *stats);
+size_t stack_format_callers(char *report, size_t off, size_t size, int stat, double total);
+int analyze_trace_files(const char **paths, int npaths, syscall_stats *out, fd_tracker *fds);
+int load_report(const char *path, syscall_stats *out);
+double hist_shift_z(const uint64_t *a, const uint64_t *b);
+void print_diff(const syscall_stats *a, const syscall_stats *b);
+void printUsage(const char *prog);